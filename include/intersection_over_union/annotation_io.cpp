@@ -0,0 +1,470 @@
+#include "annotation_io.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+#include "utils.h"
+#include "logger.h"
+
+namespace {
+	const size_t READ_BUFFER_SIZE = 1 << 20;
+
+	void appendUtf8(std::string &out, long code) {
+		if (code < 0x80) {
+			out.push_back(char(code));
+		} else if (code < 0x800) {
+			out.push_back(char(0xC0 | (code >> 6)));
+			out.push_back(char(0x80 | (code & 0x3F)));
+		} else if (code < 0x10000) {
+			out.push_back(char(0xE0 | (code >> 12)));
+			out.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+			out.push_back(char(0x80 | (code & 0x3F)));
+		} else {
+			out.push_back(char(0xF0 | (code >> 18)));
+			out.push_back(char(0x80 | ((code >> 12) & 0x3F)));
+			out.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+			out.push_back(char(0x80 | (code & 0x3F)));
+		}
+	}
+
+	// Pull parser over a buffered stream. Only what COCO files need: objects,
+	// arrays, strings and numbers, unknown values are skipped without allocation.
+	class JsonReader {
+	public:
+		JsonReader(std::istream &stream) : stream_(stream), buffer_(READ_BUFFER_SIZE), pos_(0), size_(0), ok_(true) {}
+
+		bool ok() const { return ok_; }
+
+		int peek() {
+			if (pos_ >= size_) {
+				stream_.read(&buffer_[0], buffer_.size());
+				size_ = size_t(stream_.gcount());
+				pos_ = 0;
+				if (size_ == 0) { return EOF; }
+			}
+			return (unsigned char)buffer_[pos_];
+		}
+
+		int get() {
+			int c = this->peek();
+			if (c != EOF) { pos_++; }
+			return c;
+		}
+
+		int skipWs() {
+			int c = this->peek();
+			while (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+				pos_++;
+				c = this->peek();
+			}
+			return c;
+		}
+
+		bool expect(char expected) {
+			if (this->skipWs() != expected) {
+				ok_ = false;
+				return false;
+			}
+			pos_++;
+			return true;
+		}
+
+		// Consumes ',' between members, returns false at the closing bracket
+		bool next(char closing, bool &first) {
+			int c = this->skipWs();
+			if (c == closing) {
+				pos_++;
+				return false;
+			}
+			if (!first) {
+				if (c != ',') { ok_ = false; return false; }
+				pos_++;
+			}
+			first = false;
+			return true;
+		}
+
+		// \u escapes are decoded to UTF-8 (e.g. Python's json.dump with ensure_ascii),
+		// surrogate pairs combined and unpaired surrogates replaced by U+FFFD
+		bool readString(std::string &out) {
+			out.clear();
+			if (!this->expect('"')) { return false; }
+			long high = -1;
+			int c = this->get();
+			while (c != '"') {
+				if (c == EOF) { ok_ = false; return false; }
+				long code = -1;
+				if (c == '\\') {
+					c = this->get();
+					switch (c) {
+						case EOF: { ok_ = false; return false; }
+						case 'n': { c = '\n'; break; }
+						case 't': { c = '\t'; break; }
+						case 'r': { c = '\r'; break; }
+						case 'b': { c = '\b'; break; }
+						case 'f': { c = '\f'; break; }
+						case 'u': {
+							code = this->readHex4();
+							if (code < 0) { return false; }
+							break;
+						}
+					}
+				}
+				if (high >= 0 && !(code >= 0xDC00 && code <= 0xDFFF)) {
+					appendUtf8(out, 0xFFFD);
+					high = -1;
+				}
+				if (code >= 0xD800 && code <= 0xDBFF) {
+					high = code;
+				} else if (code >= 0xDC00 && code <= 0xDFFF) {
+					appendUtf8(out, (high >= 0) ? 0x10000 + ((high - 0xD800) << 10) + (code - 0xDC00) : 0xFFFD);
+					high = -1;
+				} else if (code >= 0) {
+					appendUtf8(out, code);
+				} else {
+					out.push_back(char(c));
+				}
+				c = this->get();
+			}
+			if (high >= 0) {
+				appendUtf8(out, 0xFFFD);
+			}
+			return true;
+		}
+
+		long readHex4() {
+			long code = 0;
+			for (int i=0; i<4; i++) {
+				int c = this->get();
+				int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+				if (digit < 0) { ok_ = false; return -1; }
+				code = code * 16 + digit;
+			}
+			return code;
+		}
+
+		bool readNumber(double &value) {
+			char text[64];
+			int n = 0;
+			int c = this->skipWs();
+			while (n < 63 && ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+				text[n++] = char(c);
+				pos_++;
+				c = this->peek();
+			}
+			text[n] = 0;
+			if (n == 0) { ok_ = false; return false; }
+			value = std::strtod(text, nullptr);
+			return true;
+		}
+
+		void skipValue() {
+			int c = this->skipWs();
+			if (c == '"') {
+				std::string dummy;
+				this->readString(dummy);
+			} else if (c == '{' || c == '[') {
+				char closing = (c == '{') ? '}' : ']';
+				pos_++;
+				bool first = true;
+				while (ok_ && this->next(closing, first)) {
+					if (closing == '}') {
+						std::string key;
+						this->readString(key);
+						this->expect(':');
+					}
+					this->skipValue();
+				}
+			} else if (c == 't' || c == 'f' || c == 'n') {
+				while (c >= 'a' && c <= 'z') { pos_++; c = this->peek(); }
+			} else {
+				double dummy;
+				this->readNumber(dummy);
+			}
+		}
+
+	private:
+		std::istream &stream_;
+		std::vector<char> buffer_;
+		size_t pos_, size_;
+		bool ok_;
+	};
+
+	struct CocoBox {
+		int image_id;
+		int category_id;
+		double x, y, w, h;
+	};
+
+	void addBox(annotation_io::ImageAnnotations &image, const CocoBox &box) {
+		if (image.width <= 0 || image.height <= 0) { return; }
+		annotation_io::Annotation item;
+		item.id = box.category_id;
+		item.cx = (box.x + box.w / 2.0) / image.width;
+		item.cy = (box.y + box.h / 2.0) / image.height;
+		item.w = box.w / image.width;
+		item.h = box.h / image.height;
+		image.boxes.push_back(item);
+	}
+
+	// Every image is visited once all of its boxes can be known. After the
+	// 'annotations' array (with their boxes held, grouped by image id) that is as
+	// soon as the image is read; images listed before it are held until the end.
+	bool readCoco(std::istream &stream, annotation_io::Visitor visitor) {
+		JsonReader json(stream);
+		std::vector<annotation_io::ImageAnnotations> images;
+		std::unordered_map<int, size_t> image_index;
+		std::unordered_map<int, std::vector<CocoBox> > pending;
+		bool annotations_done = false;
+
+		if (!json.expect('{')) { return false; }
+		bool first = true;
+		std::string key, field;
+		while (json.ok() && json.next('}', first)) {
+			json.readString(key);
+			json.expect(':');
+			if (key != "images" && key != "annotations") {
+				json.skipValue();
+				continue;
+			}
+			bool is_image = (key == "images");
+			json.expect('[');
+			bool first_item = true;
+			while (json.ok() && json.next(']', first_item)) {
+				annotation_io::ImageAnnotations image;
+				CocoBox box = {-1, -1, 0.0, 0.0, 0.0, 0.0};
+				int id = -1;
+				json.expect('{');
+				bool first_field = true;
+				while (json.ok() && json.next('}', first_field)) {
+					json.readString(field);
+					json.expect(':');
+					double value = 0.0;
+					if (is_image && field == "file_name") {
+						json.readString(image.path);
+					} else if (is_image && (field == "id" || field == "width" || field == "height")) {
+						json.readNumber(value);
+						if (field == "id") { id = int(value); }
+						else if (field == "width") { image.width = int(value); }
+						else { image.height = int(value); }
+					} else if (!is_image && (field == "image_id" || field == "category_id")) {
+						json.readNumber(value);
+						if (field == "image_id") { box.image_id = int(value); } else { box.category_id = int(value); }
+					} else if (!is_image && field == "bbox") {
+						json.expect('[');
+						json.readNumber(box.x); json.expect(',');
+						json.readNumber(box.y); json.expect(',');
+						json.readNumber(box.w); json.expect(',');
+						json.readNumber(box.h);
+						json.expect(']');
+					} else {
+						json.skipValue();
+					}
+				}
+				if (is_image && annotations_done) {
+					std::unordered_map<int, std::vector<CocoBox> >::iterator it = pending.find(id);
+					if (it != pending.end()) {
+						for (size_t i=0; i<it->second.size(); i++) {
+							addBox(image, it->second[i]);
+						}
+						pending.erase(it);
+					}
+					visitor(image);
+				} else if (is_image) {
+					image_index[id] = images.size();
+					images.push_back(image);
+				} else {
+					std::unordered_map<int, size_t>::iterator it = image_index.find(box.image_id);
+					if (it != image_index.end()) {
+						addBox(images[it->second], box);
+					} else {
+						pending[box.image_id].push_back(box);
+					}
+				}
+			}
+			annotations_done = annotations_done || !is_image;
+		}
+		if (!json.ok()) { return false; }
+
+		for (size_t i=0; i<images.size(); i++) {
+			visitor(images[i]);
+		}
+		return true;
+	}
+
+	std::string escapeJson(const std::string &text) {
+		std::string out;
+		out.reserve(text.size());
+		for (size_t i=0; i<text.size(); i++) {
+			unsigned char c = (unsigned char)text[i];
+			if (c == '"' || c == '\\') {
+				out.push_back('\\');
+				out.push_back(char(c));
+			} else if (c == '\n') {
+				out += "\\n";
+			} else if (c == '\t') {
+				out += "\\t";
+			} else if (c < 0x20) {
+				// Other control characters are not allowed raw in JSON strings
+				char code[8];
+				std::snprintf(code, sizeof(code), "\\u%04x", c);
+				out += code;
+			} else {
+				out.push_back(char(c));
+			}
+		}
+		return out;
+	}
+
+	bool readLines(std::istream &stream, annotation_io::Visitor visitor) {
+		std::string line;
+		annotation_io::ImageAnnotations image;
+		while (std::getline(stream, line)) {
+			if (line.empty() || line[0] == '#') { continue; }
+			std::size_t found = line.find('\t');
+			image.path = line.substr(0, found);
+			image.boxes.clear();
+			while (found != std::string::npos) {
+				const char *text = line.c_str() + found + 1;
+				annotation_io::Annotation item;
+				if (std::sscanf(text, "%d %lf %lf %lf %lf", &item.id, &item.cx, &item.cy, &item.w, &item.h) == 5) {
+					image.boxes.push_back(item);
+				}
+				found = line.find('\t', found + 1);
+			}
+			visitor(image);
+		}
+		return true;
+	}
+}
+
+annotation_io::Format annotation_io::formatFromPath(std::string path)
+{
+	std::string ext = ".json";
+	if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0) {
+		return annotation_io::COCO_JSON;
+	}
+	return annotation_io::LINES;
+}
+
+bool annotation_io::read(std::string file, annotation_io::Visitor visitor)
+{
+	std::ifstream reader(file.c_str(), std::ios::in | std::ios::binary);
+	if (!reader.is_open()) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot open annotations: " + file);
+		return false;
+	}
+	bool ok = (annotation_io::formatFromPath(file) == annotation_io::COCO_JSON) ? readCoco(reader, visitor) : readLines(reader, visitor);
+	if (!ok) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Malformed annotations: " + file);
+	}
+	return ok;
+}
+
+std::vector<annotation_io::Annotation> annotation_io::readYoloFile(std::string label_file)
+{
+	std::vector<annotation_io::Annotation> boxes;
+	std::ifstream reader(label_file.c_str());
+	if (reader.is_open()) {
+		std::string line;
+		while (std::getline(reader, line)) {
+			annotation_io::Annotation item;
+			if (std::sscanf(line.c_str(), "%d %lf %lf %lf %lf", &item.id, &item.cx, &item.cy, &item.w, &item.h) == 5) {
+				boxes.push_back(item);
+			}
+		}
+	}
+	return boxes;
+}
+
+MyBox annotation_io::toBox(const annotation_io::Annotation &annotation, cv::Size image_size)
+{
+	MyBox box;
+	int cx = int(annotation.cx * image_size.width);
+	int cy = int(annotation.cy * image_size.height);
+	int width = int(annotation.w * image_size.width);
+	int height = int(annotation.h * image_size.height);
+	box.id = annotation.id;
+	box.cx = cx;
+	box.cy = cy;
+	box.box = cv::Rect(cx - width / 2, cy - height / 2, width, height);
+	return box;
+}
+
+annotation_io::Writer::Writer()
+{
+	format_ = annotation_io::LINES;
+	num_images_ = 0;
+	num_boxes_ = 0;
+}
+
+annotation_io::Writer::~Writer()
+{
+	if (writer_.is_open()) {
+		this->close();
+	}
+}
+
+bool annotation_io::Writer::open(std::string file, std::map<int, std::string> classnames)
+{
+	format_ = annotation_io::formatFromPath(file);
+	classnames_ = classnames;
+	num_images_ = 0;
+	num_boxes_ = 0;
+	buffer_.resize(READ_BUFFER_SIZE);
+	writer_.rdbuf()->pubsetbuf(&buffer_[0], buffer_.size());
+	writer_.open(file.c_str(), std::ios::out | std::ios::trunc);
+	if (!writer_.is_open()) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot write annotations: " + file);
+		return false;
+	}
+	if (format_ == annotation_io::COCO_JSON) {
+		writer_ << "{\"images\": [";
+	}
+	return true;
+}
+
+void annotation_io::Writer::add(const annotation_io::ImageAnnotations &image)
+{
+	if (format_ == annotation_io::LINES) {
+		writer_ << image.path;
+		for (size_t i=0; i<image.boxes.size(); i++) {
+			const annotation_io::Annotation &b = image.boxes[i];
+			writer_ << cv::format("\t%d %.17g %.17g %.17g %.17g", b.id, b.cx, b.cy, b.w, b.h);
+		}
+		writer_ << "\n";
+	} else {
+		// Images are written first; boxes are kept until close() since COCO puts them in a second array
+		writer_ << (num_images_ > 0 ? ",\n" : "\n") << "{\"id\": " << num_images_ << ", \"file_name\": \"" << escapeJson(image.path)
+			<< "\", \"width\": " << image.width << ", \"height\": " << image.height << "}";
+		for (size_t i=0; i<image.boxes.size(); i++) {
+			const annotation_io::Annotation &b = image.boxes[i];
+			double w = b.w * image.width;
+			double h = b.h * image.height;
+			double x = b.cx * image.width - w / 2.0;
+			double y = b.cy * image.height - h / 2.0;
+			pending_ += cv::format("%s\n{\"id\": %d, \"image_id\": %d, \"category_id\": %d, \"bbox\": [%.17g, %.17g, %.17g, %.17g], \"area\": %.17g, \"iscrowd\": 0}",
+				(num_boxes_ + int(i) > 0 ? "," : ""), num_boxes_ + int(i), num_images_, b.id, x, y, w, h, w * h);
+		}
+	}
+	num_images_++;
+	num_boxes_ += int(image.boxes.size());
+}
+
+bool annotation_io::Writer::close()
+{
+	if (!writer_.is_open()) { return false; }
+	if (format_ == annotation_io::COCO_JSON) {
+		writer_ << "\n],\n\"annotations\": [" << pending_ << "\n],\n\"categories\": [";
+		std::map<int, std::string>::iterator it;
+		for (it = classnames_.begin(); it != classnames_.end(); it++) {
+			writer_ << (it == classnames_.begin() ? "\n" : ",\n") << "{\"id\": " << it->first << ", \"name\": \"" << escapeJson(it->second) << "\"}";
+		}
+		writer_ << "\n]}\n";
+		pending_.clear();
+	}
+	bool ok = writer_.good();
+	writer_.close();
+	logger::info() << " |-- exported: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images, %d boxes", num_images_, num_boxes_));
+	return ok;
+}
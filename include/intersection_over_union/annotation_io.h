@@ -0,0 +1,73 @@
+#ifndef ANNOTATION_IO_H
+#define ANNOTATION_IO_H
+
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv4/opencv2/opencv.hpp>
+#include "common.h"
+
+// Consolidated annotation files. All labels of a dataset live in one file that
+// is read sequentially, instead of one darknet '.txt' file per image.
+//  - COCO_JSON: standard COCO 'images', 'annotations' and 'categories' arrays.
+//    'category_id' is the darknet class index and 'file_name' is the image
+//    path as listed in test.txt.
+//  - LINES: one image per line, '<path>\t<id> <cx> <cy> <w> <h>\t...' with
+//    normalized YOLO values. An image without labels is just '<path>'.
+namespace annotation_io {
+	enum Format {COCO_JSON, LINES};
+
+	// Normalized YOLO box, as stored in darknet label files
+	struct Annotation {
+		int id = -1;
+		double cx = 0.0;
+		double cy = 0.0;
+		double w = 0.0;
+		double h = 0.0;
+	};
+
+	struct ImageAnnotations {
+		std::string path = "";
+		int width = 0;
+		int height = 0;
+		std::vector<Annotation> boxes;
+	};
+
+	typedef std::function<void(ImageAnnotations &)> Visitor;
+
+	Format formatFromPath(std::string path);
+
+	// Streams every image record of 'file' into 'visitor'. LINES files are visited
+	// line by line. In COCO files an image needs all its boxes first: images after
+	// the 'annotations' array are visited as they are read (the boxes are held),
+	// images before it are held until the end of the file.
+	bool read(std::string file, Visitor visitor);
+
+	// Reads a single darknet label file
+	std::vector<Annotation> readYoloFile(std::string label_file);
+
+	// Same pixel conversion as the darknet label parser
+	MyBox toBox(const Annotation &annotation, cv::Size image_size);
+
+	class Writer {
+	public:
+		Writer();
+		~Writer();
+		bool open(std::string file, std::map<int, std::string> classnames);
+		void add(const ImageAnnotations &image);
+		bool close();
+	private:
+		std::ofstream writer_;
+		Format format_;
+		std::map<int, std::string> classnames_;
+		std::vector<char> buffer_;
+		std::string pending_;
+		int num_images_;
+		int num_boxes_;
+	};
+};
+
+#endif
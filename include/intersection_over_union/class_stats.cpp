@@ -0,0 +1,252 @@
+#include "class_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <yaml-cpp/yaml.h>
+#include "logger.h"
+#include "utils.h"
+
+// Each thread starts from an empty instance of the same size; partial results are added up
+#pragma omp declare reduction(merge : ClassStats : omp_out.merge(omp_in)) \
+	initializer(omp_priv = ClassStats(omp_orig.numClasses(), omp_orig.numBins()))
+
+namespace {
+	std::string className(const std::map<int, std::string> &classnames, int c) {
+		if (c < 0) { return "none"; }
+		std::map<int, std::string>::const_iterator it = classnames.find(c);
+		return (it != classnames.end()) ? it->second : std::to_string(c);
+	}
+}
+
+ClassStats::ClassStats(int num_classes, int num_bins)
+	: num_classes_(0), num_bins_(std::max(1, num_bins)), confusion_(1, 0), ignored_(0)
+{
+	this->resize(num_classes);
+}
+
+void ClassStats::resize(int num_classes)
+{
+	if (num_classes <= num_classes_) {
+		return;
+	}
+	int old_side = num_classes_ + 1;
+	int side = num_classes + 1;
+	std::vector<uint64_t> confusion(size_t(side) * side, 0);
+	for (int r=0; r<old_side; r++) {
+		for (int c=0; c<old_side; c++) {
+			// The "none" row and column move to the new last index
+			int nr = (r == num_classes_) ? num_classes : r;
+			int nc = (c == num_classes_) ? num_classes : c;
+			confusion[size_t(nr) * side + nc] = confusion_[size_t(r) * old_side + c];
+		}
+	}
+	confusion_.swap(confusion);
+	histogram_.resize(size_t(num_classes) * num_bins_, 0);
+	iou_sum_.resize(num_classes, 0.0);
+	num_classes_ = num_classes;
+}
+
+void ClassStats::add(const ResultRecord &record)
+{
+	int label = record.label_class;
+	int detected = record.detected_class;
+	if (label < -1 || detected < -1 || (label < 0 && detected < 0)) {
+		ignored_++;
+		return;
+	}
+	if (std::max(label, detected) >= num_classes_) {
+		this->resize(std::max(label, detected) + 1);
+	}
+	confusion_[size_t(index(label)) * (num_classes_ + 1) + index(detected)]++;
+	if (record.matched && label == detected) {
+		float iou = std::min(1.f, std::max(0.f, record.iou));
+		int bin = std::min(int(iou * num_bins_), num_bins_ - 1);
+		histogram_[size_t(label) * num_bins_ + bin]++;
+		iou_sum_[label] += iou;
+	}
+}
+
+void ClassStats::add(const std::vector<ResultRecord> &records)
+{
+	for (size_t i=0; i<records.size(); i++) {
+		this->add(records[i]);
+	}
+}
+
+void ClassStats::addAll(const ResultRecord *records, size_t n)
+{
+	// Sized up front, so no thread has to grow its partial result
+	int max_class = num_classes_ - 1;
+	#pragma omp parallel for reduction(max : max_class) if(n >= 16384)
+	for (long i=0; i<long(n); i++) {
+		max_class = std::max(max_class, int(std::max(records[i].label_class, records[i].detected_class)));
+	}
+	this->resize(max_class + 1);
+
+	ClassStats partial(num_classes_, num_bins_);
+	#pragma omp parallel for reduction(merge : partial) schedule(static) if(n >= 16384)
+	for (long i=0; i<long(n); i++) {
+		partial.add(records[i]);
+	}
+	this->merge(partial);
+}
+
+void ClassStats::merge(const ClassStats &other)
+{
+	if (other.num_bins_ != num_bins_) {
+		return;
+	}
+	this->resize(other.num_classes_);
+	int side = num_classes_ + 1;
+	int other_side = other.num_classes_ + 1;
+	for (int r=0; r<other_side; r++) {
+		int nr = (r == other.num_classes_) ? num_classes_ : r;
+		for (int c=0; c<other_side; c++) {
+			int nc = (c == other.num_classes_) ? num_classes_ : c;
+			confusion_[size_t(nr) * side + nc] += other.confusion_[size_t(r) * other_side + c];
+		}
+	}
+	for (size_t i=0; i<other.histogram_.size(); i++) {
+		histogram_[i] += other.histogram_[i];
+	}
+	for (size_t i=0; i<other.iou_sum_.size(); i++) {
+		iou_sum_[i] += other.iou_sum_[i];
+	}
+	ignored_ += other.ignored_;
+}
+
+uint64_t ClassStats::confusion(int label, int detected) const
+{
+	if (label >= num_classes_ || detected >= num_classes_ || label < -1 || detected < -1) {
+		return 0;
+	}
+	return confusion_[size_t(index(label)) * (num_classes_ + 1) + index(detected)];
+}
+
+uint64_t ClassStats::labels(int c) const
+{
+	if (c < 0 || c >= num_classes_) {
+		return 0;
+	}
+	uint64_t total = 0;
+	for (int d=0; d<=num_classes_; d++) {
+		total += confusion_[size_t(c) * (num_classes_ + 1) + d];
+	}
+	return total;
+}
+
+double ClassStats::meanIou(int c) const
+{
+	uint64_t n = this->correct(c);
+	return (n > 0) ? iou_sum_[c] / double(n) : 0.0;
+}
+
+double ClassStats::iouQuantile(int c, double q) const
+{
+	uint64_t n = this->correct(c);
+	if (n == 0) {
+		return 0.0;
+	}
+	const uint64_t *bins = &histogram_[size_t(c) * num_bins_];
+	double target = std::min(1.0, std::max(0.0, q)) * double(n);
+	double below = 0.0;
+	for (int b=0; b<num_bins_; b++) {
+		if (bins[b] > 0 && below + bins[b] >= target) {
+			return (b + (target - below) / double(bins[b])) / num_bins_;
+		}
+		below += bins[b];
+	}
+	return 1.0;
+}
+
+void ClassStats::report(const std::map<int, std::string> &classnames, int max_matrix) const
+{
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-16s %9s %9s %9s %9s %9s %7s %8s %8s", "class", "labels", "correct", "confused", "missed", "false_pos", "recall", "mean_iou", "med_iou");
+	logger::info() << " |-- per-class: " << utils::colorText(TextType::SUCCESS_B, line);
+	for (int c=0; c<num_classes_; c++) {
+		uint64_t n = this->labels(c);
+		uint64_t confused = n - this->correct(c) - this->missed(c);
+		std::snprintf(line, sizeof(line), "%-16.16s %9llu %9llu %9llu %9llu %9llu %7.3f %8.3f %8.3f",
+			className(classnames, c).c_str(), (unsigned long long)n, (unsigned long long)this->correct(c), (unsigned long long)confused,
+			(unsigned long long)this->missed(c), (unsigned long long)this->falsePositives(c),
+			(n > 0) ? double(this->correct(c)) / double(n) : 0.0, this->meanIou(c), this->iouQuantile(c, 0.5));
+		logger::info() << " |   " << line;
+	}
+	if (ignored_ > 0) {
+		logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, std::to_string(ignored_) + " records without a valid class were ignored");
+	}
+
+	if (num_classes_ > max_matrix) {
+		logger::info() << " |-- confusion matrix: " << utils::colorText(TextType::SUCCESS_B, std::to_string(num_classes_) + " classes, see 'stats_file'");
+		return;
+	}
+	// Rows are label classes, columns detected classes, both ending with "none"
+	std::string header = "label \\ detected";
+	for (int d=0; d<=num_classes_; d++) {
+		std::snprintf(line, sizeof(line), " %8.8s", className(classnames, d < num_classes_ ? d : -1).c_str());
+		header += line;
+	}
+	logger::info() << " |-- confusion matrix: " << utils::colorText(TextType::SUCCESS_B, header);
+	for (int r=0; r<=num_classes_; r++) {
+		std::snprintf(line, sizeof(line), "%-16.16s", className(classnames, r < num_classes_ ? r : -1).c_str());
+		std::string row = line;
+		for (int d=0; d<=num_classes_; d++) {
+			std::snprintf(line, sizeof(line), " %8llu", (unsigned long long)confusion_[size_t(r) * (num_classes_ + 1) + d]);
+			row += line;
+		}
+		logger::info() << " |   " << row;
+	}
+}
+
+bool ClassStats::save(std::string file, const std::map<int, std::string> &classnames) const
+{
+	std::vector<std::string> names;
+	for (int c=0; c<num_classes_; c++) {
+		names.push_back(className(classnames, c));
+	}
+
+	YAML::Emitter out;
+	out << YAML::BeginMap;
+	out << YAML::Key << "classes" << YAML::Value << YAML::Flow << names;
+	out << YAML::Key << "iou_bins" << YAML::Value << num_bins_;
+	out << YAML::Key << "ignored" << YAML::Value << (unsigned long long)ignored_;
+	out << YAML::Key << "per_class" << YAML::Value << YAML::BeginMap;
+	for (int c=0; c<num_classes_; c++) {
+		uint64_t n = this->labels(c);
+		out << YAML::Key << names[c] << YAML::Value << YAML::BeginMap;
+		out << YAML::Key << "labels" << YAML::Value << (unsigned long long)n;
+		out << YAML::Key << "correct" << YAML::Value << (unsigned long long)this->correct(c);
+		out << YAML::Key << "confused" << YAML::Value << (unsigned long long)(n - this->correct(c) - this->missed(c));
+		out << YAML::Key << "missed" << YAML::Value << (unsigned long long)this->missed(c);
+		out << YAML::Key << "false_positives" << YAML::Value << (unsigned long long)this->falsePositives(c);
+		out << YAML::Key << "mean_iou" << YAML::Value << this->meanIou(c);
+		out << YAML::Key << "median_iou" << YAML::Value << this->iouQuantile(c, 0.5);
+		out << YAML::Key << "iou_histogram" << YAML::Value << YAML::Flow << YAML::BeginSeq;
+		for (int b=0; b<num_bins_; b++) {
+			out << (unsigned long long)histogram_[size_t(c) * num_bins_ + b];
+		}
+		out << YAML::EndSeq;
+		out << YAML::EndMap;
+	}
+	out << YAML::EndMap;
+	// Row per label class, column per detected class, the last of each is "none"
+	out << YAML::Key << "confusion" << YAML::Value << YAML::BeginSeq;
+	for (int r=0; r<=num_classes_; r++) {
+		out << YAML::Flow << YAML::BeginSeq;
+		for (int d=0; d<=num_classes_; d++) {
+			out << (unsigned long long)confusion_[size_t(r) * (num_classes_ + 1) + d];
+		}
+		out << YAML::EndSeq;
+	}
+	out << YAML::EndSeq;
+	out << YAML::EndMap;
+
+	std::ofstream writer(file.c_str());
+	if (!writer.is_open()) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot write class statistics: " + file);
+		return false;
+	}
+	writer << out.c_str() << "\n";
+	return writer.good();
+}
@@ -0,0 +1,55 @@
+#ifndef CLASS_STATS_H
+#define CLASS_STATS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "result_writer.h"
+
+// Per-class evaluation statistics built from ResultRecords: a confusion matrix
+// (labels x detections, plus a "none" row/column for false positives and
+// misses) and a histogram of the IoU of correctly classified matches.
+// Instances are merged by adding counts, so each thread can fill its own and
+// the partial results are combined in an OpenMP reduction.
+class ClassStats {
+public:
+	explicit ClassStats(int num_classes = 0, int num_bins = 20);
+
+	// Grows to 'num_classes' keeping the counts; never shrinks
+	void resize(int num_classes);
+	void add(const ResultRecord &record);
+	void add(const std::vector<ResultRecord> &records);
+	// Parallel over 'records'; grows to the largest class id found first
+	void addAll(const ResultRecord *records, size_t n);
+	void merge(const ClassStats &other);
+
+	int numClasses() const { return num_classes_; }
+	int numBins() const { return num_bins_; }
+	// -1 for "none": no detection matched the label, or no label matched the detection
+	uint64_t confusion(int label, int detected) const;
+	uint64_t labels(int c) const;
+	uint64_t correct(int c) const { return confusion(c, c); }
+	uint64_t missed(int c) const { return confusion(c, -1); }
+	uint64_t falsePositives(int c) const { return confusion(-1, c); }
+	uint64_t ignored() const { return ignored_; }
+	// Over correctly classified matches; 'q' in [0, 1], interpolated within a histogram bin
+	double meanIou(int c) const;
+	double iouQuantile(int c, double q) const;
+
+	// Logs the per-class table, and the confusion matrix for up to 'max_matrix' classes
+	void report(const std::map<int, std::string> &classnames, int max_matrix = 16) const;
+	bool save(std::string file, const std::map<int, std::string> &classnames) const;
+
+private:
+	int index(int c) const { return (c < 0) ? num_classes_ : c; }
+
+	int num_classes_;
+	int num_bins_;
+	std::vector<uint64_t> confusion_;		// (C + 1) x (C + 1), row: label, column: detection, C: none
+	std::vector<uint64_t> histogram_;		// C x bins
+	std::vector<double> iou_sum_;
+	uint64_t ignored_;						// records with a class id below -1
+};
+
+#endif
@@ -9,8 +9,9 @@ struct MyBox {
 	int cx = -1;
 	int cy = -1;
 	cv::Rect box;
+	float confidence = -1.f;
 	
-	bool isOk() {
+	bool isOk() const {
 		return cx >= 0 && cy >= 0 && id >= 0;
 	}
 };
@@ -3,19 +3,17 @@
 #include <sys/time.h>
 #include <ctime>
 #include "utils.h"
+#include "logger.h"
 
 namespace cvdnn_detector {
 	std::vector<std::string> getNetModelOutputsNames(const cv::dnn::Net &net) {
-		static std::vector<std::string> names;
-		if (names.empty()) {
-			// Get the indices of the output layers
-			std::vector<int> out_layers = net.getUnconnectedOutLayers();
-			// get names of all layers in network
-			std::vector<cv::String> layernames = net.getLayerNames();
-			names.resize(int(out_layers.size()));
-			for (size_t i=0; i<out_layers.size(); i++) {
-				names[i] = layernames[out_layers[i] - 1];
-			}
+		// Get the indices of the output layers
+		std::vector<int> out_layers = net.getUnconnectedOutLayers();
+		// get names of all layers in network
+		std::vector<cv::String> layernames = net.getLayerNames();
+		std::vector<std::string> names(out_layers.size());
+		for (size_t i=0; i<out_layers.size(); i++) {
+			names[i] = layernames[out_layers[i] - 1];
 		}
 		return names;
 	}
@@ -46,15 +44,46 @@ void Detector::init(
 	net_size_ = cv::Size(net_width, net_height);
 	conf_thr_ = confidence_threshold;
 	nms_thr_ = nms_threshold;
+	nms_params_.score_thr = float(conf_thr_);
+	nms_params_.iou_thr = float(nms_thr_);
 	
+	// Fixed seed, so every detector instance draws a class with the same color
+	cv::RNG rng(12345);
 	std::map<int, std::string>::iterator it;
 	for (it = classnames_.begin(); it != classnames_.end(); it++) {
-		colors_.insert(std::pair<int, cv::Scalar>(it->first, cv::Scalar(rand()%100, rand()%100, rand()%100)));
+		colors_.insert(std::pair<int, cv::Scalar>(it->first, cv::Scalar(rng.uniform(0, 100), rng.uniform(0, 100), rng.uniform(0, 100))));
 	}
 	
 	net_ = cv::dnn::readNet(weights_file, cfg_file);
 	net_.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
 	net_.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+	// Cached per instance, several detectors may run on different threads
+	out_names_ = cvdnn_detector::getNetModelOutputsNames(net_);
+}
+
+void Detector::setNmsOptions(nms::Mode mode, nms::Method method, double sigma)
+{
+	nms_params_.mode = mode;
+	nms_params_.method = method;
+	nms_params_.sigma = float(sigma);
+}
+
+void Detector::setThresholds(double confidence_threshold, double nms_threshold)
+{
+	conf_thr_ = confidence_threshold;
+	nms_thr_ = nms_threshold;
+	nms_params_.score_thr = float(conf_thr_);
+	nms_params_.iou_thr = float(nms_thr_);
+}
+
+void Detector::warmUp()
+{
+	const int shape[4] = { 1, 3, net_size_.height, net_size_.width };
+	blob_.create(4, shape, CV_32F);
+	blob_.setTo(cv::Scalar::all(0));
+	net_.setInput(blob_);
+	std::vector<cv::Mat> outs;
+	net_.forward(outs, out_names_);
 }
 
 char Detector::detect(MyImageInfo &item, cv::Mat &dst)
@@ -62,11 +91,17 @@ char Detector::detect(MyImageInfo &item, cv::Mat &dst)
 		auto t_start = std::chrono::high_resolution_clock::now();
 		
 		dst = item.image.clone();
-		cv::Mat blob = cv::dnn::blobFromImage(dst, scale_, net_size_, mean_, true, false);
-		net_.setInput(blob);
+		if (!preprocess::toBlob(dst, net_size_, letterbox_, scale_, mean_, plan_, blob_, num_threads_)) {
+			// Not 8-bit BGR, the fused kernel does not handle it
+			blob_ = cv::dnn::blobFromImage(dst, scale_, net_size_, mean_, true, false);
+			preprocess::makePlan(dst.size(), net_size_, false, plan_);
+		}
+		net_.setInput(blob_);
+		auto t_preprocess = std::chrono::high_resolution_clock::now();
 		
 		std::vector<cv::Mat> outs;
-		net_.forward(outs, cvdnn_detector::getNetModelOutputsNames(net_));
+		net_.forward(outs, out_names_);
+		auto t_forward = std::chrono::high_resolution_clock::now();
 		
 		std::vector<int> class_ids;
 		std::vector<float> confidences;
@@ -83,15 +118,9 @@ char Detector::detect(MyImageInfo &item, cv::Mat &dst)
             cv::minMaxLoc(scores, 0, &conf, 0, &class_id_point);
             if (conf > conf_thr_) {
                 // std::cout << " -- conf: " << conf << std::endl;
-                int cx = int(data[0] * dst.cols);
-                int cy = int(data[1] * dst.rows);
-                int w = int(data[2] * dst.cols);
-                int h = int(data[3] * dst.rows);
-                int minx = cx - w / 2;
-                int miny = cy - h / 2;
                 class_ids.push_back(class_id_point.x);
                 confidences.push_back(conf);
-                boxes.push_back(cv::Rect(minx, miny, w, h));
+                boxes.push_back(plan_.toSource(data[0], data[1], data[2], data[3]));
             }
         }
     }
@@ -103,12 +132,14 @@ char Detector::detect(MyImageInfo &item, cv::Mat &dst)
 		item.detections.clear();
 		
     std::vector<int> indices;
+    std::vector<float> kept_scores;
 		int text_height = 20;
-    cv::dnn::NMSBoxes(boxes, confidences, conf_thr_, nms_thr_, indices);
+    nms::run(boxes, confidences, class_ids, nms_params_, indices, &kept_scores);
     for (size_t i=0; i<indices.size(); i++) {
         int idx = indices[i];
         cv::Rect box = boxes[idx];
         int class_id = class_ids[idx];
+        float confidence = kept_scores[i];
 				
 				std::map<int, std::string>::iterator it = classnames_.find(class_id);
 				std::map<int, cv::Scalar>::iterator it2 = colors_.find(class_id);
@@ -118,9 +149,10 @@ char Detector::detect(MyImageInfo &item, cv::Mat &dst)
 				MyBox result;
 				result.id = class_id;
 				result.box = box;
+				result.confidence = confidence;
 				item.detections.push_back(result);
 				
-        std::string text = cv::format("[%d] %s, %.2f", class_id, it->second.c_str(), confidences[idx]);
+        std::string text = cv::format("[%d] %s, %.2f", class_id, it->second.c_str(), confidence);
         //std::cout << " >> Detected: " << text << ", " << confidences[idx] << std::endl;
         int baseline = 0;
         cv::Size tsize = cv::getTextSize(text, fontface, fontscale, thickness, &baseline);
@@ -133,7 +165,11 @@ char Detector::detect(MyImageInfo &item, cv::Mat &dst)
 
     auto t_end = std::chrono::high_resolution_clock::now();
     double elapsed = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-		std::cout << "    Detection elapsed: " << utils::colorText(TextType::SUCCESS_B, cv::format("%.3lf ms", elapsed)) << std::endl;
+		timing_.preprocess = std::chrono::duration<double, std::milli>(t_preprocess - t_start).count();
+		timing_.forward = std::chrono::duration<double, std::milli>(t_forward - t_preprocess).count();
+		timing_.postprocess = std::chrono::duration<double, std::milli>(t_end - t_forward).count();
+		timing_.total = elapsed;
+		logger::debug() << "    Detection elapsed: " << utils::colorText(TextType::SUCCESS_B, cv::format("%.3lf ms", elapsed));
     
     // Put efficiency information.
     std::vector<double> layersTimes;
@@ -144,7 +180,6 @@ char Detector::detect(MyImageInfo &item, cv::Mat &dst)
 		cv::putText(dst, cv::format("Inference time: %.3lf ms", t), cv::Point(10, int(20 + text_height * 1.5)), fontface, fontscale, cv::Scalar(0, 255, 0), thickness);
 		cv::putText(dst, cv::format("Total elapsed: %.3lf ms", elapsed), cv::Point(10, int(20 + text_height * 3.0)), fontface, fontscale, cv::Scalar(0, 255, 0), thickness);
 	
-		blob.release();
 		return ' ';
 }
 
@@ -9,9 +9,19 @@
 #include <opencv4/opencv2/opencv.hpp>
 #include <opencv4/opencv2/dnn.hpp>
 #include "common.h"
+#include "nms.h"
+#include "preprocess.h"
 
 namespace cvdnn_detector {
 	std::vector<std::string> getNetModelOutputsNames(const cv::dnn::Net &net);
+	
+	// Wall-clock time of the stages of the last Detector::detect call, in ms
+	struct Timing {
+		double preprocess = 0.0;
+		double forward = 0.0;
+		double postprocess = 0.0;
+		double total = 0.0;
+	};
 };
 
 class Detector {
@@ -27,15 +37,32 @@ public:
 		double confidence_threshold,
 		double nms_threshold
 	);
+	void setNmsOptions(nms::Mode mode, nms::Method method, double sigma);
+	void setThresholds(double confidence_threshold, double nms_threshold);
+	// Keep the aspect ratio and pad the network input instead of stretching the image
+	void setLetterbox(bool letterbox) { letterbox_ = letterbox; }
+	// OpenMP threads of the preprocessing (0: all), see preprocess::run
+	void setThreads(int num_threads) { num_threads_ = num_threads; }
+	// One forward pass on a blank input, so the first real image does not pay for lazy allocations
+	void warmUp();
 	char detect(MyImageInfo &item, cv::Mat &dst);
+	const cvdnn_detector::Timing &lastTiming() const { return timing_; }
 private:
 	cv::dnn::Net net_;
+	std::vector<std::string> out_names_;
 	std::map<int, std::string> classnames_;
 	std::map<int, cv::Scalar> colors_;
 	cv::Scalar mean_;
 	double scale_;
 	cv::Size net_size_;
 	double conf_thr_, nms_thr_;
+	nms::Params nms_params_;
+	bool letterbox_ = false;
+	int num_threads_ = 0;
+	// Input tensor and resize tables, reused while the image size stays the same
+	preprocess::Plan plan_;
+	cv::Mat blob_;
+	cvdnn_detector::Timing timing_;
 };
 
 #endif
@@ -0,0 +1,154 @@
+#include "dataset_store.h"
+#include <algorithm>
+
+DatasetStore::DatasetStore()
+{
+	this->clear();
+}
+
+void DatasetStore::clear()
+{
+	pool_.clear();
+	dir_ids_.clear();
+	dir_offset_.clear();
+	dir_end_.clear();
+	dir_of_image_.clear();
+	name_offset_.clear();
+	name_end_.clear();
+	width_.clear();
+	height_.clear();
+	label_offset_.assign(1, 0);
+	label_id_.clear();
+	label_cx_.clear();
+	label_cy_.clear();
+	label_w_.clear();
+	label_h_.clear();
+}
+
+void DatasetStore::reserve(size_t num_images, size_t num_labels)
+{
+	dir_of_image_.reserve(num_images);
+	name_offset_.reserve(num_images);
+	name_end_.reserve(num_images);
+	width_.reserve(num_images);
+	height_.reserve(num_images);
+	label_offset_.reserve(num_images + 1);
+	label_id_.reserve(num_labels);
+	label_cx_.reserve(num_labels);
+	label_cy_.reserve(num_labels);
+	label_w_.reserve(num_labels);
+	label_h_.reserve(num_labels);
+}
+
+size_t DatasetStore::addImage(const std::string &key)
+{
+	std::size_t found = key.rfind('/');
+	std::string dir = (found == std::string::npos) ? "" : key.substr(0, found + 1);
+
+	uint32_t dir_id;
+	std::unordered_map<std::string, uint32_t>::iterator it = dir_ids_.find(dir);
+	if (it == dir_ids_.end()) {
+		dir_id = uint32_t(dir_offset_.size());
+		dir_offset_.push_back(uint32_t(pool_.size()));
+		pool_ += dir;
+		dir_end_.push_back(uint32_t(pool_.size()));
+		dir_ids_.insert(std::pair<std::string, uint32_t>(dir, dir_id));
+	} else {
+		dir_id = it->second;
+	}
+
+	dir_of_image_.push_back(dir_id);
+	name_offset_.push_back(uint32_t(pool_.size()));
+	pool_.append(key, dir.size(), std::string::npos);
+	name_end_.push_back(uint32_t(pool_.size()));
+	width_.push_back(0);
+	height_.push_back(0);
+	label_offset_.push_back(label_offset_.back());
+	return name_offset_.size() - 1;
+}
+
+void DatasetStore::addLabel(const annotation_io::Annotation &label)
+{
+	label_id_.push_back(int32_t(label.id));
+	label_cx_.push_back(label.cx);
+	label_cy_.push_back(label.cy);
+	label_w_.push_back(label.w);
+	label_h_.push_back(label.h);
+	label_offset_.back() = uint32_t(label_id_.size());
+}
+
+void DatasetStore::setImageSize(size_t index, cv::Size size)
+{
+	width_[index] = uint32_t(std::max(size.width, 0));
+	height_[index] = uint32_t(std::max(size.height, 0));
+}
+
+std::string DatasetStore::key(size_t index) const
+{
+	uint32_t dir = dir_of_image_[index];
+	return pool_.substr(dir_offset_[dir], dir_end_[dir] - dir_offset_[dir]) + this->name(index);
+}
+
+std::string DatasetStore::name(size_t index) const
+{
+	return pool_.substr(name_offset_[index], name_end_[index] - name_offset_[index]);
+}
+
+cv::Size DatasetStore::imageSize(size_t index) const
+{
+	return cv::Size(int(width_[index]), int(height_[index]));
+}
+
+void DatasetStore::annotations(size_t index, std::vector<annotation_io::Annotation> &labels) const
+{
+	labels.clear();
+	for (uint32_t i=label_offset_[index]; i<label_offset_[index + 1]; i++) {
+		annotation_io::Annotation item;
+		item.id = label_id_[i];
+		item.cx = label_cx_[i];
+		item.cy = label_cy_[i];
+		item.w = label_w_[i];
+		item.h = label_h_[i];
+		labels.push_back(item);
+	}
+}
+
+void DatasetStore::labels(size_t index, cv::Size image_size, std::vector<MyBox> &boxes) const
+{
+	boxes.clear();
+	annotation_io::Annotation item;
+	for (uint32_t i=label_offset_[index]; i<label_offset_[index + 1]; i++) {
+		item.id = label_id_[i];
+		item.cx = label_cx_[i];
+		item.cy = label_cy_[i];
+		item.w = label_w_[i];
+		item.h = label_h_[i];
+		MyBox box = annotation_io::toBox(item, image_size);
+		if (box.id >= 0 && box.box.width > 0 && box.box.height > 0) {
+			boxes.push_back(box);
+		}
+	}
+}
+
+MyImageInfo DatasetStore::load(size_t index, const std::string &image_root) const
+{
+	MyImageInfo item;
+	item.name = this->name(index);
+	item.path = image_root + "/" + this->key(index);
+	item.image = cv::imread(item.path, cv::IMREAD_COLOR);
+	if (!item.image.empty()) {
+		this->labels(index, item.image.size(), item.labels);
+	}
+	return item;
+}
+
+size_t DatasetStore::memoryBytes() const
+{
+	size_t bytes = pool_.capacity();
+	bytes += (dir_offset_.capacity() + dir_end_.capacity() + dir_of_image_.capacity()) * sizeof(uint32_t);
+	bytes += (name_offset_.capacity() + name_end_.capacity() + label_offset_.capacity()) * sizeof(uint32_t);
+	bytes += (width_.capacity() + height_.capacity()) * sizeof(uint32_t);
+	bytes += label_id_.capacity() * sizeof(int32_t);
+	bytes += (label_cx_.capacity() + label_cy_.capacity() + label_w_.capacity() + label_h_.capacity()) * sizeof(double);
+	return bytes;
+}
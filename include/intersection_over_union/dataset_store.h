@@ -0,0 +1,59 @@
+#ifndef DATASET_STORE_H
+#define DATASET_STORE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv4/opencv2/opencv.hpp>
+#include "common.h"
+#include "annotation_io.h"
+
+// Compact, pixel-free description of a test set. Image paths are split into an
+// interned directory and a file name, both stored in one string pool. Labels of
+// all images sit in contiguous arrays (normalized, in double precision like the
+// text parser so that the pixel boxes are the same), the labels of image i
+// being [label_offset_[i], label_offset_[i + 1]).
+class DatasetStore {
+public:
+	DatasetStore();
+	void clear();
+	void reserve(size_t num_images, size_t num_labels);
+
+	// 'key' is the image path relative to the image root, as listed in test.txt.
+	// Labels added afterwards belong to this image.
+	size_t addImage(const std::string &key);
+	void addLabel(const annotation_io::Annotation &label);
+	void setImageSize(size_t index, cv::Size size);
+
+	size_t size() const { return name_offset_.size(); }
+	size_t numLabels() const { return label_id_.size(); }
+	size_t numLabels(size_t index) const { return label_offset_[index + 1] - label_offset_[index]; }
+	std::string key(size_t index) const;
+	std::string name(size_t index) const;
+	cv::Size imageSize(size_t index) const;
+	void annotations(size_t index, std::vector<annotation_io::Annotation> &labels) const;
+
+	// Pixel labels for a decoded image, filtered like the darknet label parser
+	void labels(size_t index, cv::Size image_size, std::vector<MyBox> &boxes) const;
+
+	// Decodes the image from disk and fills in its labels
+	MyImageInfo load(size_t index, const std::string &image_root) const;
+
+	size_t memoryBytes() const;
+
+private:
+	std::string pool_;
+	std::unordered_map<std::string, uint32_t> dir_ids_;
+	std::vector<uint32_t> dir_offset_;		// interned directory d is [dir_offset_[d], dir_end_[d])
+	std::vector<uint32_t> dir_end_;
+	std::vector<uint32_t> dir_of_image_;
+	std::vector<uint32_t> name_offset_;		// name of image i is [name_offset_[i], name_end_[i])
+	std::vector<uint32_t> name_end_;
+	std::vector<uint32_t> width_, height_;
+	std::vector<uint32_t> label_offset_;
+	std::vector<int32_t> label_id_;
+	std::vector<double> label_cx_, label_cy_, label_w_, label_h_;
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "eval_server.h"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+	bool sendLine(int fd, const std::string &line) {
+		std::string data = line + "\n";
+		size_t sent = 0;
+		while (sent < data.size()) {
+			// MSG_NOSIGNAL: a client that hung up must not kill the server with SIGPIPE
+			ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) { continue; }
+			if (n <= 0) { return false; }
+			sent += size_t(n);
+		}
+		return true;
+	}
+}
+
+EvalServer::EvalServer(int num_workers, Handler handler)
+	: num_workers_(num_workers), handler_(handler), listen_fd_(-1), stop_(false)
+{
+}
+
+EvalServer::~EvalServer()
+{
+	if (listen_fd_ >= 0) {
+		::close(listen_fd_);
+		::unlink(socket_path_.c_str());
+	}
+}
+
+bool EvalServer::listen(std::string socket_path)
+{
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path)) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid socket path: " + socket_path);
+		return false;
+	}
+	std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+	listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd_ < 0) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, std::string("Cannot create socket: ") + std::strerror(errno));
+		return false;
+	}
+	// Left over by a server that did not shut down cleanly
+	::unlink(socket_path.c_str());
+	if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listen_fd_, 64) < 0) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot listen on " + socket_path + ": " + std::strerror(errno));
+		::close(listen_fd_);
+		listen_fd_ = -1;
+		return false;
+	}
+	socket_path_ = socket_path;
+	logger::info() << " |-- listening: " << utils::colorText(TextType::SUCCESS_B, socket_path + " (" + std::to_string(num_workers_) + " workers)");
+	return true;
+}
+
+void EvalServer::serve()
+{
+	if (listen_fd_ < 0) {
+		return;
+	}
+	for (int i=0; i<num_workers_; i++) {
+		workers_.push_back(std::thread(&EvalServer::workerLoop, this, i));
+	}
+
+	while (!stop_) {
+		// Wake up regularly to notice requestStop()
+		pollfd pfd;
+		pfd.fd = listen_fd_;
+		pfd.events = POLLIN;
+		if (::poll(&pfd, 1, 200) <= 0) {
+			continue;
+		}
+		int fd = ::accept(listen_fd_, nullptr, nullptr);
+		if (fd < 0) {
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			connections_.insert(fd);
+		}
+		std::thread(&EvalServer::connectionLoop, this, fd).detach();
+	}
+
+	logger::info() << " |-- " << utils::colorText(TextType::WARNING_B, "Stopping server");
+	std::unique_lock<std::mutex> lock(mutex_);
+	// Unblocks the connections waiting for their next request, running jobs still finish
+	std::set<int>::iterator it;
+	for (it = connections_.begin(); it != connections_.end(); it++) {
+		::shutdown(*it, SHUT_RD);
+	}
+	work_cv_.notify_all();
+	connections_cv_.wait(lock, [this]() { return connections_.empty(); });
+	lock.unlock();
+	for (size_t i=0; i<workers_.size(); i++) {
+		workers_[i].join();
+	}
+	workers_.clear();
+}
+
+void EvalServer::connectionLoop(int fd)
+{
+	std::string buffer;
+	char chunk[4096];
+	bool alive = true;
+	while (alive && !stop_) {
+		size_t end = buffer.find('\n');
+		if (end == std::string::npos) {
+			ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+			if (n < 0 && errno == EINTR) { continue; }
+			if (n <= 0) { break; }
+			buffer.append(chunk, size_t(n));
+			continue;
+		}
+		std::string line = buffer.substr(0, end);
+		buffer.erase(0, end + 1);
+		if (!line.empty() && line[line.size() - 1] == '\r') { line.erase(line.size() - 1); }
+		if (line.empty()) { continue; }
+
+		std::shared_ptr<Job> job(new Job());
+		std::string error;
+		if (!parseRequest(line, job->request, error)) {
+			alive = sendLine(fd, "error\t" + error);
+			continue;
+		}
+		job->emit = [fd](const std::string &response) { return sendLine(fd, response); };
+		if (!this->run(job) && !job->done) {
+			alive = sendLine(fd, "error\tserver stopping");
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	::close(fd);
+	connections_.erase(fd);
+	connections_cv_.notify_all();
+}
+
+bool EvalServer::run(const std::shared_ptr<Job> &job)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (stop_) {
+		return false;
+	}
+	queue_.push_back(job);
+	work_cv_.notify_one();
+	done_cv_.wait(lock, [&]() { return job->done || (stop_ && !job->emit); });
+	return job->ok;
+}
+
+void EvalServer::workerLoop(int worker)
+{
+	while (true) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			work_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+			if (stop_) {
+				// Jobs still queued are dropped, their connections report it
+				while (!queue_.empty()) {
+					queue_.front()->emit = EvalServer::Emit();
+					queue_.pop_front();
+				}
+				done_cv_.notify_all();
+				return;
+			}
+			job = queue_.front();
+			queue_.pop_front();
+		}
+
+		bool ok = false;
+		try {
+			ok = handler_(worker, job->request, job->emit);
+		} catch (const std::exception &e) {
+			job->emit(std::string("error\t") + e.what());
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		job->ok = ok;
+		job->done = true;
+		done_cv_.notify_all();
+	}
+}
+
+bool EvalServer::parseRequest(const std::string &line, EvalRequest &request, std::string &error)
+{
+	try {
+		YAML::Node node = YAML::Load(line);
+		if (!node.IsMap()) {
+			error = "request must be a map, e.g. {config: config/iou.yaml}";
+			return false;
+		}
+		if (!node["config"]) {
+			error = "missing 'config'";
+			return false;
+		}
+		request.config_file = node["config"].as<std::string>();
+		request.weights_file = node["weights"] ? node["weights"].as<std::string>() : "";
+		request.cfg_file = node["cfg"] ? node["cfg"].as<std::string>() : "";
+		request.conf_thr = node["conf_thr"] ? node["conf_thr"].as<double>() : -1.0;
+		request.nms_thr = node["nms_thr"] ? node["nms_thr"].as<double>() : -1.0;
+		request.records = node["records"] ? node["records"].as<bool>() : true;
+		if (request.conf_thr > 1.0 || request.nms_thr > 1.0) {
+			error = "conf_thr and nms_thr must not be above 1";
+			return false;
+		}
+	} catch (const YAML::Exception &e) {
+		error = std::string("malformed request: ") + e.what();
+		return false;
+	}
+	return true;
+}
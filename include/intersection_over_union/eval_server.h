@@ -0,0 +1,75 @@
+#ifndef EVAL_SERVER_H
+#define EVAL_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One evaluation job, sent by a client as a single-line YAML map, e.g.
+//   {config: config/iou.yaml, conf_thr: 0.5, nms_thr: 0.3}
+struct EvalRequest {
+	std::string config_file = "";		// test set and default model
+	std::string weights_file = "";	// empty: from the config
+	std::string cfg_file = "";
+	double conf_thr = -1.0;					// negative: from the config
+	double nms_thr = -1.0;
+	bool records = true;						// stream the per-box records too
+};
+
+// Accepts evaluation requests over a Unix domain socket and runs them on a
+// fixed pool of workers. Every connection sends one request per line and gets
+// the response lines of a request before its next one is read. 'handler' is
+// called with the index of the worker, so it can keep per-worker state such
+// as loaded networks.
+class EvalServer {
+public:
+	// Sends one or more response lines, returns false once the client is gone
+	typedef std::function<bool(const std::string &line)> Emit;
+	typedef std::function<bool(int worker, const EvalRequest &request, const Emit &emit)> Handler;
+
+	EvalServer(int num_workers, Handler handler);
+	~EvalServer();
+
+	bool listen(std::string socket_path);
+	// Blocks until requestStop() is called
+	void serve();
+	// Only sets a flag, safe to call from a signal handler
+	void requestStop() { stop_ = true; }
+
+	static bool parseRequest(const std::string &line, EvalRequest &request, std::string &error);
+
+private:
+	struct Job {
+		EvalRequest request;
+		Emit emit;
+		bool done = false;
+		bool ok = false;
+	};
+
+	void connectionLoop(int fd);
+	void workerLoop(int worker);
+	// Queues 'job' and waits until a worker finished it
+	bool run(const std::shared_ptr<Job> &job);
+
+	int num_workers_;
+	Handler handler_;
+	std::string socket_path_;
+	int listen_fd_;
+	std::atomic<bool> stop_;
+
+	std::mutex mutex_;
+	std::condition_variable work_cv_, done_cv_;
+	std::deque<std::shared_ptr<Job> > queue_;
+	std::set<int> connections_;
+	std::condition_variable connections_cv_;
+	std::vector<std::thread> workers_;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include "frame_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <unistd.h>
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+	template <typename T>
+	void appendValue(std::vector<uchar> &out, const T &value) {
+		const uchar *p = reinterpret_cast<const uchar*>(&value);
+		out.insert(out.end(), p, p + sizeof(T));
+	}
+
+	template <typename T>
+	bool readValue(const std::vector<uchar> &in, size_t &pos, T &value) {
+		if (pos + sizeof(T) > in.size()) { return false; }
+		std::memcpy(&value, &in[pos], sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	// name, accuracy, records, then the image as PNG (fastest compression level)
+	bool encodeFrame(const RenderedFrame &frame, std::vector<uchar> &out) {
+		std::vector<uchar> png;
+		if (!cv::imencode(".png", frame.image, png, {cv::IMWRITE_PNG_COMPRESSION, 1})) {
+			return false;
+		}
+		out.clear();
+		out.reserve(png.size() + frame.name.size() + frame.records.size() * sizeof(ResultRecord) + 32);
+		appendValue(out, uint32_t(frame.name.size()));
+		out.insert(out.end(), frame.name.begin(), frame.name.end());
+		appendValue(out, frame.accuracy);
+		appendValue(out, uint32_t(frame.records.size()));
+		const uchar *records = reinterpret_cast<const uchar*>(frame.records.data());
+		out.insert(out.end(), records, records + frame.records.size() * sizeof(ResultRecord));
+		appendValue(out, uint64_t(png.size()));
+		out.insert(out.end(), png.begin(), png.end());
+		return true;
+	}
+
+	bool decodeFrame(const std::vector<uchar> &in, RenderedFrame &frame) {
+		size_t pos = 0;
+		uint32_t name_size = 0, num_records = 0;
+		uint64_t png_size = 0;
+		if (!readValue(in, pos, name_size) || pos + name_size > in.size()) { return false; }
+		frame.name.assign(reinterpret_cast<const char*>(&in[pos]), name_size);
+		pos += name_size;
+		if (!readValue(in, pos, frame.accuracy) || !readValue(in, pos, num_records)) { return false; }
+		if (pos + size_t(num_records) * sizeof(ResultRecord) > in.size()) { return false; }
+		frame.records.resize(num_records);
+		std::memcpy(frame.records.data(), &in[pos], frame.records.size() * sizeof(ResultRecord));
+		pos += frame.records.size() * sizeof(ResultRecord);
+		if (!readValue(in, pos, png_size) || pos + png_size != in.size()) { return false; }
+		frame.image = cv::imdecode(cv::Mat(1, int(png_size), CV_8U, const_cast<uchar*>(&in[pos])), cv::IMREAD_UNCHANGED);
+		frame.ok = !frame.image.empty();
+		return frame.ok;
+	}
+
+	double toMb(size_t bytes) {
+		return bytes / (1024.0 * 1024.0);
+	}
+}
+
+FrameCache::FrameCache()
+	: enabled_(false), budget_bytes_(0), hits_(0), spill_hits_(0), misses_(0), peak_bytes_(0),
+	spill_failed_(false), spill_end_(0)
+{
+}
+
+FrameCache::~FrameCache()
+{
+	std::lock_guard<std::mutex> lock(spill_mutex_);
+	this->removeSpillFile();
+}
+
+void FrameCache::open(size_t budget_bytes, size_t max_frames, std::string spill_file)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	enabled_ = (budget_bytes > 0 || max_frames > 0);
+	budget_bytes_ = budget_bytes;
+	memory_.clear();
+	memory_.setCapacity(max_frames > 0 ? max_frames : size_t(-1));
+	memory_.setMaxCost(budget_bytes);
+	memory_.setKeepEvicted(spill_file != "");
+	hits_ = spill_hits_ = misses_ = 0;
+	peak_bytes_ = 0;
+	std::lock_guard<std::mutex> spill_lock(spill_mutex_);
+	this->removeSpillFile();
+	spill_prefix_ = spill_file;
+	spill_failed_ = false;
+}
+
+bool FrameCache::get(int key, RenderedFrame &frame)
+{
+	return this->lookup(key, frame, true);
+}
+
+bool FrameCache::peek(int key, RenderedFrame &frame)
+{
+	return this->lookup(key, frame, false);
+}
+
+bool FrameCache::peekMemory(int key, RenderedFrame &frame)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return enabled_ && memory_.get(key, frame);
+}
+
+bool FrameCache::contains(int key)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!enabled_) { return false; }
+		if (memory_.contains(key)) { return true; }
+	}
+	std::lock_guard<std::mutex> lock(spill_mutex_);
+	return spilled_.find(key) != spilled_.end();
+}
+
+bool FrameCache::lookup(int key, RenderedFrame &frame, bool count)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!enabled_) { return false; }
+		if (memory_.contains(key)) {
+			memory_.get(key, frame);
+			hits_ += count ? 1 : 0;
+			return true;
+		}
+	}
+	if (!this->readSpilled(key, frame)) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		misses_ += count ? 1 : 0;
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		spill_hits_ += count ? 1 : 0;
+	}
+	// Back in memory, as the most recently used frame
+	this->put(key, frame);
+	return true;
+}
+
+void FrameCache::put(int key, const RenderedFrame &frame)
+{
+	std::vector<std::pair<int, RenderedFrame> > evicted;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!enabled_) { return; }
+		memory_.put(key, frame, frameBytes(frame));
+		peak_bytes_ = std::max(peak_bytes_, memory_.cost());
+		memory_.takeEvicted(evicted);
+	}
+	// Compressed and written without holding the cache lock
+	this->spill(evicted);
+}
+
+void FrameCache::spill(const std::vector<std::pair<int, RenderedFrame> > &evicted)
+{
+	std::vector<uchar> buffer;
+	for (size_t i=0; i<evicted.size(); i++) {
+		const RenderedFrame &frame = evicted[i].second;
+		if (!frame.ok || frame.image.empty()) { continue; }
+		{
+			// A frame read back from the spill file is already in it
+			std::lock_guard<std::mutex> lock(spill_mutex_);
+			if (spill_failed_ || spilled_.find(evicted[i].first) != spilled_.end()) { continue; }
+		}
+		if (!encodeFrame(frame, buffer)) { continue; }
+
+		std::lock_guard<std::mutex> lock(spill_mutex_);
+		if (spill_failed_ || spilled_.find(evicted[i].first) != spilled_.end()) { continue; }
+		if (!spill_.is_open() && !this->createSpillFile()) {
+			logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Cannot create cache spill file, evicted frames are dropped: " + spill_prefix_ + ".XXXXXX");
+			spill_failed_ = true;
+			continue;
+		}
+		spill_.seekp(std::streamoff(spill_end_));
+		spill_.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		spill_.flush();
+		if (!spill_) {
+			logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Cache spill file is full or unwritable, evicted frames are dropped: " + spill_file_);
+			spill_failed_ = true;
+			continue;
+		}
+		SpillEntry entry = { spill_end_, uint64_t(buffer.size()) };
+		spilled_[evicted[i].first] = entry;
+		spill_end_ += buffer.size();
+	}
+}
+
+bool FrameCache::createSpillFile()
+{
+	// mkstemp only creates a new file: concurrent caches (e.g. --serve jobs) and
+	// files already at that path are never shared or truncated
+	std::string pattern = spill_prefix_ + ".XXXXXX";
+	std::vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+	int fd = mkstemp(path.data());
+	if (fd < 0) {
+		return false;
+	}
+	close(fd);
+	spill_file_ = path.data();
+	spill_.open(spill_file_.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	if (!spill_.is_open()) {
+		this->removeSpillFile();
+		return false;
+	}
+	return true;
+}
+
+void FrameCache::removeSpillFile()
+{
+	if (spill_.is_open()) {
+		spill_.close();
+	}
+	if (spill_file_ != "") {
+		std::remove(spill_file_.c_str());
+		spill_file_ = "";
+	}
+	spilled_.clear();
+	spill_end_ = 0;
+}
+
+bool FrameCache::readSpilled(int key, RenderedFrame &frame)
+{
+	std::vector<uchar> buffer;
+	{
+		std::lock_guard<std::mutex> lock(spill_mutex_);
+		std::unordered_map<int, SpillEntry>::iterator it = spilled_.find(key);
+		if (it == spilled_.end() || !spill_.is_open()) {
+			return false;
+		}
+		buffer.resize(size_t(it->second.size));
+		spill_.seekg(std::streamoff(it->second.offset));
+		spill_.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		if (!spill_) {
+			spill_.clear();
+			return false;
+		}
+	}
+	RenderedFrame loaded;
+	if (!decodeFrame(buffer, loaded)) {
+		return false;
+	}
+	frame = loaded;
+	return true;
+}
+
+FrameCache::Stats FrameCache::stats()
+{
+	Stats stats;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats.hits = hits_;
+		stats.spill_hits = spill_hits_;
+		stats.misses = misses_;
+		stats.frames = memory_.size();
+		stats.bytes = memory_.cost();
+		stats.peak_bytes = peak_bytes_;
+	}
+	std::lock_guard<std::mutex> lock(spill_mutex_);
+	stats.spilled = spilled_.size();
+	stats.spill_bytes = size_t(spill_end_);
+	return stats;
+}
+
+void FrameCache::report(const std::string &name)
+{
+	if (!enabled_) {
+		return;
+	}
+	Stats s = this->stats();
+	size_t lookups = s.hits + s.spill_hits + s.misses;
+	double rate = (lookups > 0) ? 100.0 * (s.hits + s.spill_hits) / lookups : 0.0;
+	std::string text = cv::format("%d / %d hits (%.1lf%%, %d from spill), peak %.1lf MB", int(s.hits + s.spill_hits), int(lookups), rate, int(s.spill_hits), toMb(s.peak_bytes));
+	if (budget_bytes_ > 0) {
+		text += cv::format(" of %.1lf MB", toMb(budget_bytes_));
+	}
+	if (spill_prefix_ != "") {
+		text += cv::format(", %d frames spilled (%.1lf MB)", int(s.spilled), toMb(s.spill_bytes));
+	}
+	logger::info() << " |-- " << name << " cache: " << utils::colorText(TextType::SUCCESS_B, text);
+}
+
+size_t FrameCache::frameBytes(const RenderedFrame &frame)
+{
+	return sizeof(RenderedFrame) + frame.name.capacity() + frame.image.total() * frame.image.elemSize()
+		+ frame.records.capacity() * sizeof(ResultRecord);
+}
@@ -0,0 +1,94 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv4/opencv2/opencv.hpp>
+#include "lru_cache.h"
+#include "result_writer.h"
+
+// Annotated image as shown by the viewer, or a decoded test image without records
+struct RenderedFrame {
+	bool ok = false;
+	std::string name = "";
+	cv::Mat image;
+	double accuracy = 0.0;
+	std::vector<ResultRecord> records;
+};
+
+// Thread-safe cache of frames by dataset index, bounded by a memory budget.
+// The least recently used frames are evicted; with a spill file they are
+// first compressed into it (lossless PNG, records as is) and read back on the
+// next access instead of being decoded or rendered again. Each cache creates
+// its own spill file, '<spill_file>.XXXXXX', and never reuses an existing one.
+class FrameCache {
+public:
+	FrameCache();
+	// Removes the spill file
+	~FrameCache();
+
+	// 'budget_bytes' 0: no memory limit, 'max_frames' 0: no count limit, both 0 disable
+	// the cache. The spill file is only created once the first frame is evicted,
+	// 'spill_file' is the prefix of its unique name.
+	void open(size_t budget_bytes, size_t max_frames, std::string spill_file = "");
+	bool enabled() const { return enabled_; }
+
+	bool get(int key, RenderedFrame &frame);
+	// Like get(), but not counted as a hit or miss
+	bool peek(int key, RenderedFrame &frame);
+	// Like peek(), but never reads the spill file: cheap enough to call under another lock
+	bool peekMemory(int key, RenderedFrame &frame);
+	bool contains(int key);
+	void put(int key, const RenderedFrame &frame);
+
+	struct Stats {
+		size_t hits = 0;				// found in memory
+		size_t spill_hits = 0;	// read back from the spill file
+		size_t misses = 0;
+		size_t frames = 0;			// in memory now
+		size_t bytes = 0;
+		size_t peak_bytes = 0;
+		size_t spilled = 0;			// frames in the spill file
+		size_t spill_bytes = 0;
+	};
+	Stats stats();
+	// One line with the hit rate, memory use and spill file size
+	void report(const std::string &name);
+
+	static size_t frameBytes(const RenderedFrame &frame);
+
+private:
+	bool lookup(int key, RenderedFrame &frame, bool count);
+	void spill(const std::vector<std::pair<int, RenderedFrame> > &evicted);
+	// Called with spill_mutex_ held
+	bool createSpillFile();
+	void removeSpillFile();
+	bool readSpilled(int key, RenderedFrame &frame);
+
+	struct SpillEntry {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	bool enabled_;
+	size_t budget_bytes_;
+	std::mutex mutex_;
+	LruCache<int, RenderedFrame> memory_;
+	size_t hits_, spill_hits_, misses_;
+	size_t peak_bytes_;
+
+	std::mutex spill_mutex_;
+	std::string spill_prefix_;
+	std::string spill_file_;	// created file, empty until the first spill
+	std::fstream spill_;
+	bool spill_failed_;
+	uint64_t spill_end_;
+	std::unordered_map<int, SpillEntry> spilled_;
+};
+
+#endif
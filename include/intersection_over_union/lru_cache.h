@@ -0,0 +1,114 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Least-recently-used map bounded by a number of entries and, optionally, by
+// the sum of the per-entry costs (e.g. bytes). Not thread safe, callers lock.
+template <typename Key, typename Value>
+class LruCache {
+public:
+	LruCache(size_t capacity = 16) : capacity_(capacity), max_cost_(0), cost_(0), keep_evicted_(false), hits_(0), misses_(0) {}
+
+	void setCapacity(size_t capacity) {
+		capacity_ = capacity;
+		this->trim();
+	}
+
+	// 0: no cost limit. The most recent entry is kept even if it alone exceeds the limit.
+	void setMaxCost(size_t max_cost) {
+		max_cost_ = max_cost;
+		this->trim();
+	}
+
+	// Collects the entries dropped by trimming until takeEvicted(), e.g. to spill them
+	void setKeepEvicted(bool keep) { keep_evicted_ = keep; }
+
+	size_t capacity() const { return capacity_; }
+	size_t maxCost() const { return max_cost_; }
+	size_t size() const { return index_.size(); }
+	size_t cost() const { return cost_; }
+	size_t hits() const { return hits_; }
+	size_t misses() const { return misses_; }
+
+	bool contains(const Key &key) const {
+		return index_.find(key) != index_.end();
+	}
+
+	// Copies the value out and marks it as most recently used
+	bool get(const Key &key, Value &value) {
+		typename Index::iterator it = index_.find(key);
+		if (it == index_.end()) {
+			misses_++;
+			return false;
+		}
+		items_.splice(items_.begin(), items_, it->second);
+		value = it->second->value;
+		hits_++;
+		return true;
+	}
+
+	void put(const Key &key, const Value &value, size_t cost = 0) {
+		typename Index::iterator it = index_.find(key);
+		if (it != index_.end()) {
+			cost_ = cost_ - it->second->cost + cost;
+			it->second->value = value;
+			it->second->cost = cost;
+			items_.splice(items_.begin(), items_, it->second);
+		} else {
+			items_.push_front(Entry(key, value, cost));
+			index_[key] = items_.begin();
+			cost_ += cost;
+		}
+		this->trim();
+	}
+
+	void takeEvicted(std::vector<std::pair<Key, Value> > &evicted) {
+		evicted.clear();
+		evicted.swap(evicted_);
+	}
+
+	void clear() {
+		items_.clear();
+		index_.clear();
+		evicted_.clear();
+		cost_ = 0;
+	}
+
+private:
+	struct Entry {
+		Entry(const Key &k, const Value &v, size_t c) : key(k), value(v), cost(c) {}
+		Key key;
+		Value value;
+		size_t cost;
+	};
+	typedef std::list<Entry> Items;
+	typedef std::unordered_map<Key, typename Items::iterator> Index;
+
+	void trim() {
+		while (!items_.empty() && (index_.size() > capacity_ || (max_cost_ > 0 && cost_ > max_cost_ && index_.size() > 1))) {
+			Entry &oldest = items_.back();
+			if (keep_evicted_) {
+				evicted_.push_back(std::pair<Key, Value>(oldest.key, oldest.value));
+			}
+			cost_ -= oldest.cost;
+			index_.erase(oldest.key);
+			items_.pop_back();
+		}
+	}
+
+	size_t capacity_;
+	size_t max_cost_;
+	size_t cost_;
+	bool keep_evicted_;
+	size_t hits_, misses_;
+	Items items_;
+	Index index_;
+	std::vector<std::pair<Key, Value> > evicted_;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "nms.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+namespace {
+	// Uniform grid over the candidate boxes of one NMS group. Every box is
+	// registered in each cell it covers, so two overlapping boxes always share
+	// at least one cell and only the boxes around a candidate get compared.
+	class SpatialGrid {
+	public:
+		SpatialGrid(const std::vector<cv::Rect> &boxes, const std::vector<int> &group) {
+			min_x_ = 0; min_y_ = 0; cols_ = 1; rows_ = 1; cell_ = 1;
+			if (group.empty()) { return; }
+			int max_x = boxes[group[0]].x, max_y = boxes[group[0]].y;
+			min_x_ = max_x; min_y_ = max_y;
+			double sum_w = 0.0, sum_h = 0.0;
+			for (size_t i=0; i<group.size(); i++) {
+				const cv::Rect &r = boxes[group[i]];
+				min_x_ = std::min(min_x_, r.x);
+				min_y_ = std::min(min_y_, r.y);
+				max_x = std::max(max_x, r.x + std::max(r.width, 0));
+				max_y = std::max(max_y, r.y + std::max(r.height, 0));
+				sum_w += std::max(r.width, 0);
+				sum_h += std::max(r.height, 0);
+			}
+			// Cells roughly the size of an average box keep the per-box cell count small
+			double avg = std::max(sum_w, sum_h) / double(group.size());
+			cell_ = std::max(1, int(std::ceil(avg)));
+			// Few tiny boxes spread over the frame must not allocate a huge grid on every call
+			const int max_cells = 1024;
+			const long long max_total = 4 * (long long)group.size();
+			while ((max_x - min_x_) / cell_ + 1 > max_cells || (max_y - min_y_) / cell_ + 1 > max_cells
+				|| (long long)((max_x - min_x_) / cell_ + 1) * ((max_y - min_y_) / cell_ + 1) > max_total) {
+				cell_ *= 2;
+			}
+			cols_ = (max_x - min_x_) / cell_ + 1;
+			rows_ = (max_y - min_y_) / cell_ + 1;
+			cells_.resize(cols_ * rows_);
+		}
+
+		void insert(int index, const cv::Rect &r) {
+			int x0, y0, x1, y1;
+			this->cellRange(r, x0, y0, x1, y1);
+			for (int y=y0; y<=y1; y++) {
+				for (int x=x0; x<=x1; x++) {
+					cells_[y * cols_ + x].push_back(index);
+				}
+			}
+		}
+
+		// Calls 'visitor' for every registered box sharing a cell with 'r' until it returns false.
+		template <typename Visitor>
+		bool visit(const cv::Rect &r, Visitor visitor) const {
+			int x0, y0, x1, y1;
+			this->cellRange(r, x0, y0, x1, y1);
+			for (int y=y0; y<=y1; y++) {
+				for (int x=x0; x<=x1; x++) {
+					const std::vector<int> &cell = cells_[y * cols_ + x];
+					for (size_t i=0; i<cell.size(); i++) {
+						if (!visitor(cell[i])) { return false; }
+					}
+				}
+			}
+			return true;
+		}
+
+	private:
+		void cellRange(const cv::Rect &r, int &x0, int &y0, int &x1, int &y1) const {
+			x0 = std::min(std::max((r.x - min_x_) / cell_, 0), cols_ - 1);
+			y0 = std::min(std::max((r.y - min_y_) / cell_, 0), rows_ - 1);
+			x1 = std::min(std::max((r.x + std::max(r.width, 0) - min_x_) / cell_, 0), cols_ - 1);
+			y1 = std::min(std::max((r.y + std::max(r.height, 0) - min_y_) / cell_, 0), rows_ - 1);
+		}
+
+		int min_x_, min_y_, cols_, rows_, cell_;
+		std::vector<std::vector<int> > cells_;
+	};
+
+	struct Kept {
+		int index;
+		int rank;
+		float score;
+	};
+
+	bool isDegenerate(const cv::Rect &r) {
+		return r.area() <= 0;
+	}
+
+	void hardNMS(
+		const std::vector<cv::Rect> &boxes,
+		const std::vector<int> &group,
+		const std::vector<int> &rank,
+		const std::vector<float> &scores,
+		float iou_thr,
+		std::vector<Kept> &kept
+	) {
+		SpatialGrid grid(boxes, group);
+		bool has_degenerate = false;
+		for (size_t i=0; i<group.size(); i++) {
+			int idx = group[i];
+			const cv::Rect &box = boxes[idx];
+			bool keep = true;
+			if (isDegenerate(box)) {
+				// OpenCV treats two empty boxes as a full overlap and anything else as none
+				keep = !(has_degenerate && 1.f > iou_thr);
+				has_degenerate = has_degenerate || keep;
+			} else {
+				keep = grid.visit(box, [&](int k) {
+					return nms::iou(box, boxes[k]) <= iou_thr;
+				});
+				if (keep) { grid.insert(idx, box); }
+			}
+			if (keep) {
+				Kept item;
+				item.index = idx;
+				item.rank = rank[idx];
+				item.score = scores[idx];
+				kept.push_back(item);
+			}
+		}
+	}
+
+	void softNMS(
+		const std::vector<cv::Rect> &boxes,
+		const std::vector<int> &group,
+		const std::vector<int> &rank,
+		const std::vector<float> &scores,
+		const nms::Params &params,
+		std::vector<Kept> &kept
+	) {
+		SpatialGrid grid(boxes, group);
+		std::vector<float> current(boxes.size(), 0.f);
+		std::vector<char> alive(boxes.size(), 0);
+		std::vector<int> stamp(boxes.size(), -1);
+		typedef std::pair<float, int> Entry;
+		// Highest score first, earlier rank first on ties (same order as the hard pass)
+		auto cmp = [&](const Entry &a, const Entry &b) {
+			return (a.first != b.first) ? a.first < b.first : rank[a.second] > rank[b.second];
+		};
+		std::priority_queue<Entry, std::vector<Entry>, decltype(cmp)> queue(cmp);
+		for (size_t i=0; i<group.size(); i++) {
+			int idx = group[i];
+			grid.insert(idx, boxes[idx]);
+			current[idx] = scores[idx];
+			alive[idx] = 1;
+			queue.push(Entry(scores[idx], idx));
+		}
+
+		int round = 0;
+		while (!queue.empty()) {
+			Entry top = queue.top();
+			queue.pop();
+			int idx = top.second;
+			// Skip entries made stale by a later decay of the same box
+			if (!alive[idx] || current[idx] != top.first) { continue; }
+			if (top.first <= params.score_thr) { break; }
+			alive[idx] = 0;
+
+			Kept item;
+			item.index = idx;
+			item.rank = rank[idx];
+			item.score = top.first;
+			kept.push_back(item);
+
+			const cv::Rect &box = boxes[idx];
+			grid.visit(box, [&](int k) {
+				if (!alive[k] || stamp[k] == round) { return true; }
+				stamp[k] = round;
+				float overlap = nms::iou(box, boxes[k]);
+				float decay = 1.f;
+				if (params.method == nms::SOFT_LINEAR) {
+					decay = (overlap > params.iou_thr) ? 1.f - overlap : 1.f;
+				} else {
+					decay = std::exp(-(overlap * overlap) / params.sigma);
+				}
+				if (decay < 1.f) {
+					current[k] *= decay;
+					queue.push(Entry(current[k], k));
+				}
+				return true;
+			});
+			round++;
+		}
+	}
+}
+
+bool nms::parseMode(std::string text, nms::Mode &mode)
+{
+	if (text == "class_aware") { mode = nms::CLASS_AWARE; return true; }
+	if (text == "class_agnostic") { mode = nms::CLASS_AGNOSTIC; return true; }
+	return false;
+}
+
+bool nms::parseMethod(std::string text, nms::Method &method)
+{
+	if (text == "hard") { method = nms::HARD; return true; }
+	if (text == "soft_linear") { method = nms::SOFT_LINEAR; return true; }
+	if (text == "soft_gaussian") { method = nms::SOFT_GAUSSIAN; return true; }
+	return false;
+}
+
+float nms::iou(const cv::Rect &a, const cv::Rect &b)
+{
+	int area_a = a.area();
+	int area_b = b.area();
+	if (area_a + area_b <= 0) {
+		return 1.f;
+	}
+	double inter = (a & b).area();
+	return 1.f - float(1.0 - inter / (area_a + area_b - inter));
+}
+
+void nms::run(
+	const std::vector<cv::Rect> &boxes,
+	const std::vector<float> &scores,
+	const std::vector<int> &class_ids,
+	const nms::Params &params,
+	std::vector<int> &indices,
+	std::vector<float> *kept_scores
+) {
+	indices.clear();
+	if (kept_scores) { kept_scores->clear(); }
+
+	// Candidates above the score threshold, sorted like cv::dnn::NMSBoxes (stable, descending)
+	std::vector<int> order;
+	order.reserve(boxes.size());
+	for (size_t i=0; i<boxes.size(); i++) {
+		if (scores[i] > params.score_thr) {
+			order.push_back(int(i));
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return scores[a] > scores[b];
+	});
+	if (params.top_k > 0 && (int)order.size() > params.top_k) {
+		order.resize(params.top_k);
+	}
+
+	std::vector<int> rank(boxes.size(), 0);
+	for (size_t i=0; i<order.size(); i++) {
+		rank[order[i]] = int(i);
+	}
+
+	std::map<int, std::vector<int> > groups;
+	for (size_t i=0; i<order.size(); i++) {
+		int key = (params.mode == nms::CLASS_AWARE) ? class_ids[order[i]] : 0;
+		groups[key].push_back(order[i]);
+	}
+
+	std::vector<Kept> kept;
+	std::map<int, std::vector<int> >::iterator it;
+	for (it = groups.begin(); it != groups.end(); it++) {
+		if (params.method == nms::HARD) {
+			hardNMS(boxes, it->second, rank, scores, params.iou_thr, kept);
+		} else {
+			softNMS(boxes, it->second, rank, scores, params, kept);
+		}
+	}
+
+	std::sort(kept.begin(), kept.end(), [](const Kept &a, const Kept &b) {
+		return (a.score != b.score) ? a.score > b.score : a.rank < b.rank;
+	});
+	indices.reserve(kept.size());
+	for (size_t i=0; i<kept.size(); i++) {
+		indices.push_back(kept[i].index);
+		if (kept_scores) { kept_scores->push_back(kept[i].score); }
+	}
+}
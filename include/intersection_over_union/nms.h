@@ -0,0 +1,39 @@
+#ifndef NMS_H
+#define NMS_H
+
+#include <vector>
+#include <string>
+#include <opencv4/opencv2/opencv.hpp>
+
+namespace nms {
+	enum Mode {CLASS_AWARE, CLASS_AGNOSTIC};
+	enum Method {HARD, SOFT_LINEAR, SOFT_GAUSSIAN};
+
+	struct Params {
+		float score_thr = 0.5f;
+		float iou_thr = 0.4f;
+		Mode mode = CLASS_AGNOSTIC;	// like cv::dnn::NMSBoxes
+		Method method = HARD;
+		float sigma = 0.5f;		// gaussian soft-NMS only
+		int top_k = 0;				// 0 keeps every candidate
+	};
+
+	bool parseMode(std::string text, Mode &mode);
+	bool parseMethod(std::string text, Method &method);
+
+	// Same overlap measure as cv::dnn::NMSBoxes (1 - jaccard distance)
+	float iou(const cv::Rect &a, const cv::Rect &b);
+
+	// Returns indices of kept boxes sorted by descending score. With soft-NMS
+	// the decayed score of every kept box is written to 'kept_scores'.
+	void run(
+		const std::vector<cv::Rect> &boxes,
+		const std::vector<float> &scores,
+		const std::vector<int> &class_ids,
+		const Params &params,
+		std::vector<int> &indices,
+		std::vector<float> *kept_scores = nullptr
+	);
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "perf_baseline.h"
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <yaml-cpp/yaml.h>
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+	std::vector<double> afterWarmup(const std::vector<double> &values, int warmup) {
+		size_t skip = std::min(values.size(), size_t(std::max(warmup, 0)));
+		// Never drop everything on tiny sets
+		if (skip == values.size()) { skip = 0; }
+		return std::vector<double>(values.begin() + skip, values.end());
+	}
+
+	// Percentile-bootstrap interval of stat(current) / stat(baseline)
+	void bootstrapRatio(
+		const std::vector<double> &baseline,
+		const std::vector<double> &current,
+		double q,
+		const perf::Tolerance &tolerance,
+		std::mt19937 &rng,
+		double &lo,
+		double &hi
+	) {
+		std::vector<double> ratios;
+		ratios.reserve(tolerance.resamples);
+		std::vector<double> a(baseline.size()), b(current.size());
+		std::uniform_int_distribution<size_t> pick_a(0, baseline.size() - 1);
+		std::uniform_int_distribution<size_t> pick_b(0, current.size() - 1);
+		for (int r=0; r<tolerance.resamples; r++) {
+			for (size_t i=0; i<a.size(); i++) { a[i] = baseline[pick_a(rng)]; }
+			for (size_t i=0; i<b.size(); i++) { b[i] = current[pick_b(rng)]; }
+			double base = perf::percentile(a, q);
+			if (base > 0.0) {
+				ratios.push_back(perf::percentile(b, q) / base);
+			}
+		}
+		if (ratios.empty()) {
+			lo = hi = 1.0;
+			return;
+		}
+		double alpha = (1.0 - tolerance.confidence) / 2.0;
+		lo = perf::percentile(ratios, alpha);
+		hi = perf::percentile(ratios, 1.0 - alpha);
+	}
+}
+
+void perf::Recorder::setStages(const std::vector<std::string> &stages)
+{
+	stages_ = stages;
+	images_.clear();
+	samples_.assign(stages.size(), std::vector<double>());
+}
+
+void perf::Recorder::add(const std::string &image, const std::vector<double> &stage_ms)
+{
+	images_.push_back(image);
+	for (size_t i=0; i<samples_.size() && i<stage_ms.size(); i++) {
+		samples_[i].push_back(stage_ms[i]);
+	}
+}
+
+bool perf::Recorder::save(std::string file) const
+{
+	YAML::Emitter out;
+	out << YAML::BeginMap;
+	out << YAML::Key << "meta" << YAML::Value << YAML::BeginMap;
+	std::map<std::string, std::string>::const_iterator it;
+	for (it = meta_.begin(); it != meta_.end(); it++) {
+		out << YAML::Key << it->first << YAML::Value << it->second;
+	}
+	out << YAML::EndMap;
+	out << YAML::Key << "images" << YAML::Value << YAML::Flow << images_;
+	out << YAML::Key << "samples_ms" << YAML::Value << YAML::BeginMap;
+	for (size_t i=0; i<stages_.size(); i++) {
+		out << YAML::Key << stages_[i] << YAML::Value << YAML::Flow << samples_[i];
+	}
+	out << YAML::EndMap;
+	out << YAML::EndMap;
+
+	std::ofstream writer(file.c_str());
+	if (!writer.is_open()) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot write baseline: " + file);
+		return false;
+	}
+	writer << out.c_str() << "\n";
+	return writer.good();
+}
+
+bool perf::Recorder::load(std::string file)
+{
+	if (!utils::isValidPath(file)) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + file);
+		return false;
+	}
+	try {
+		YAML::Node node = YAML::LoadFile(file);
+		meta_.clear();
+		stages_.clear();
+		samples_.clear();
+		images_ = node["images"] ? node["images"].as<std::vector<std::string> >() : std::vector<std::string>();
+		for (YAML::const_iterator it = node["meta"].begin(); node["meta"] && it != node["meta"].end(); ++it) {
+			meta_[it->first.as<std::string>()] = it->second.as<std::string>();
+		}
+		for (YAML::const_iterator it = node["samples_ms"].begin(); node["samples_ms"] && it != node["samples_ms"].end(); ++it) {
+			stages_.push_back(it->first.as<std::string>());
+			samples_.push_back(it->second.as<std::vector<double> >());
+		}
+	} catch (const YAML::Exception &e) {
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Malformed baseline " + file + ": " + e.what());
+		return false;
+	}
+	return !stages_.empty();
+}
+
+double perf::percentile(std::vector<double> values, double q)
+{
+	if (values.empty()) { return 0.0; }
+	// Linear interpolation between the closest ranks
+	double pos = q * (values.size() - 1);
+	size_t lower = size_t(pos);
+	std::nth_element(values.begin(), values.begin() + lower, values.end());
+	double a = values[lower];
+	if (lower + 1 >= values.size()) { return a; }
+	double b = *std::min_element(values.begin() + lower + 1, values.end());
+	return a + (b - a) * (pos - lower);
+}
+
+std::vector<perf::StageReport> perf::compare(const perf::Recorder &baseline, const perf::Recorder &current, const perf::Tolerance &tolerance)
+{
+	std::vector<perf::StageReport> reports;
+	std::mt19937 rng(42);
+	for (size_t i=0; i<current.stages().size(); i++) {
+		const std::string &stage = current.stages()[i];
+		std::vector<std::string>::const_iterator found = std::find(baseline.stages().begin(), baseline.stages().end(), stage);
+		if (found == baseline.stages().end()) { continue; }
+		std::vector<double> base = afterWarmup(baseline.samples(found - baseline.stages().begin()), tolerance.warmup);
+		std::vector<double> cur = afterWarmup(current.samples(i), tolerance.warmup);
+		if (base.empty() || cur.empty()) { continue; }
+
+		perf::StageReport report;
+		report.stage = stage;
+		report.base_median = perf::percentile(base, 0.5);
+		report.median = perf::percentile(cur, 0.5);
+		report.base_p99 = perf::percentile(base, 0.99);
+		report.p99 = perf::percentile(cur, 0.99);
+		bootstrapRatio(base, cur, 0.5, tolerance, rng, report.median_lo, report.median_hi);
+		bootstrapRatio(base, cur, 0.99, tolerance, rng, report.p99_lo, report.p99_hi);
+		report.regressed = report.median_lo > 1.0 + tolerance.median || report.p99_lo > 1.0 + tolerance.p99;
+		reports.push_back(report);
+	}
+	return reports;
+}
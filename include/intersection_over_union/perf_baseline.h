@@ -0,0 +1,56 @@
+#ifndef PERF_BASELINE_H
+#define PERF_BASELINE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Latency baselines for catching slowdowns after OpenCV or weight upgrades.
+// A run records one latency per image and stage; two runs are compared with
+// bootstrap confidence intervals of the median and p99 ratios.
+namespace perf {
+	class Recorder {
+	public:
+		void setStages(const std::vector<std::string> &stages);
+		// 'stage_ms' holds one value per stage, in the order of setStages()
+		void add(const std::string &image, const std::vector<double> &stage_ms);
+
+		const std::vector<std::string> &stages() const { return stages_; }
+		const std::vector<std::string> &images() const { return images_; }
+		const std::vector<double> &samples(size_t stage) const { return samples_[stage]; }
+		std::map<std::string, std::string> &meta() { return meta_; }
+		const std::map<std::string, std::string> &meta() const { return meta_; }
+
+		bool save(std::string file) const;
+		bool load(std::string file);
+
+	private:
+		std::vector<std::string> stages_;
+		std::vector<std::string> images_;
+		std::vector<std::vector<double> > samples_;
+		std::map<std::string, std::string> meta_;
+	};
+
+	struct Tolerance {
+		double median = 0.10;		// allowed relative slowdown of the median
+		double p99 = 0.25;			// allowed relative slowdown of the p99
+		double confidence = 0.95;
+		int resamples = 1000;
+		int warmup = 3;					// leading images left out of the statistics
+	};
+
+	// Ratios are current / baseline; a stage regresses when the lower bound of
+	// a ratio interval is above 1 + tolerance.
+	struct StageReport {
+		std::string stage = "";
+		double base_median = 0.0, median = 0.0, median_lo = 0.0, median_hi = 0.0;
+		double base_p99 = 0.0, p99 = 0.0, p99_lo = 0.0, p99_hi = 0.0;
+		bool regressed = false;
+	};
+
+	double percentile(std::vector<double> values, double q);
+
+	std::vector<StageReport> compare(const Recorder &baseline, const Recorder &current, const Tolerance &tolerance);
+};
+
+#endif
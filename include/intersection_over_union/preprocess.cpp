@@ -0,0 +1,210 @@
+#include "preprocess.h"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+namespace {
+	// Source coordinates of 'dst_size' pixel centers, like cv::INTER_LINEAR
+	void makeTable(int src_size, int dst_size, int channels, std::vector<int> &p0, std::vector<int> &p1, std::vector<float> &w) {
+		double inv_scale = double(src_size) / double(dst_size);
+		p0.resize(dst_size);
+		p1.resize(dst_size);
+		w.resize(dst_size);
+		for (int d=0; d<dst_size; d++) {
+			double f = (d + 0.5) * inv_scale - 0.5;
+			int s = int(std::floor(f));
+			f -= s;
+			if (s < 0) {
+				s = 0;
+				f = 0.0;
+			}
+			if (s >= src_size - 1) {
+				s = src_size - 1;
+				f = 0.0;
+			}
+			p0[d] = s * channels;
+			p1[d] = std::min(s + 1, src_size - 1) * channels;
+			w[d] = float(f);
+		}
+	}
+
+	// Horizontal pass of one source row into three planar (R, G, B) rows
+	void resampleRow(const uchar *src, const preprocess::Plan &plan, float *r, float *g, float *b) {
+		const int *x0 = plan.x0.data();
+		const int *x1 = plan.x1.data();
+		const float *wx = plan.wx.data();
+		int width = plan.resized.width;
+		for (int x=0; x<width; x++) {
+			const uchar *p0 = src + x0[x];
+			const uchar *p1 = src + x1[x];
+			float w = wx[x];
+			b[x] = p0[0] + (p1[0] - p0[0]) * w;
+			g[x] = p0[1] + (p1[1] - p0[1]) * w;
+			r[x] = p0[2] + (p1[2] - p0[2]) * w;
+		}
+	}
+
+	void blendRows(const uchar *a, const uchar *b, int n, float wa, float wb, float *dst) {
+		#pragma omp simd
+		for (int i=0; i<n; i++) {
+			dst[i] = a[i] * wa + b[i] * wb;
+		}
+	}
+
+	// Horizontal pass of a blended BGR row, scaled into the three output planes
+	void resampleBlended(const float *row, const preprocess::Plan &plan, float scale, const float mean_scaled[3], float *out[3]) {
+		const int *x0 = plan.x0.data();
+		const int *x1 = plan.x1.data();
+		const float *wx = plan.wx.data();
+		int width = plan.resized.width;
+		float *r = out[0], *g = out[1], *b = out[2];
+		for (int x=0; x<width; x++) {
+			const float *p0 = row + x0[x];
+			const float *p1 = row + x1[x];
+			float w = wx[x];
+			b[x] = (p0[0] + (p1[0] - p0[0]) * w) * scale - mean_scaled[2];
+			g[x] = (p0[1] + (p1[1] - p0[1]) * w) * scale - mean_scaled[1];
+			r[x] = (p0[2] + (p1[2] - p0[2]) * w) * scale - mean_scaled[0];
+		}
+	}
+}
+
+cv::Rect preprocess::Plan::toSource(float cx, float cy, float w, float h) const
+{
+	int icx, icy, iw, ih;
+	if (!letterbox) {
+		icx = int(cx * src.width);
+		icy = int(cy * src.height);
+		iw = int(w * src.width);
+		ih = int(h * src.height);
+	} else {
+		icx = int((cx * net.width - pad_x) / scale_x);
+		icy = int((cy * net.height - pad_y) / scale_y);
+		iw = int(w * net.width / scale_x);
+		ih = int(h * net.height / scale_y);
+	}
+	return cv::Rect(icx - iw / 2, icy - ih / 2, iw, ih);
+}
+
+void preprocess::makePlan(cv::Size src, cv::Size net, bool letterbox, preprocess::Plan &plan)
+{
+	plan.src = src;
+	plan.net = net;
+	plan.letterbox = letterbox;
+	if (letterbox) {
+		double r = std::min(double(net.width) / src.width, double(net.height) / src.height);
+		plan.resized = cv::Size(
+			std::max(1, std::min(net.width, int(std::round(src.width * r)))),
+			std::max(1, std::min(net.height, int(std::round(src.height * r))))
+		);
+		plan.pad_x = (net.width - plan.resized.width) / 2;
+		plan.pad_y = (net.height - plan.resized.height) / 2;
+	} else {
+		plan.resized = net;
+		plan.pad_x = 0;
+		plan.pad_y = 0;
+	}
+	plan.scale_x = double(plan.resized.width) / src.width;
+	plan.scale_y = double(plan.resized.height) / src.height;
+	makeTable(src.width, plan.resized.width, 3, plan.x0, plan.x1, plan.wx);
+	makeTable(src.height, plan.resized.height, 1, plan.y0, plan.y1, plan.wy);
+}
+
+void preprocess::run(const cv::Mat &bgr, const preprocess::Plan &plan, double scale, const cv::Scalar &mean, float *dst, float pad_value, int num_threads)
+{
+	const int W = plan.net.width;
+	const int H = plan.net.height;
+	const int rw = plan.resized.width;
+	const size_t plane = size_t(W) * H;
+	const size_t src_step = bgr.step[0];
+	const uchar *src = bgr.data;
+	// Mean is given in output (RGB) order, as with blobFromImage(swapRB=true)
+	const float k = float(scale);
+	const float mean_scaled[3] = { float(mean[0] * scale), float(mean[1] * scale), float(mean[2] * scale) };
+	const float pad[3] = { pad_value * k - mean_scaled[0], pad_value * k - mean_scaled[1], pad_value * k - mean_scaled[2] };
+
+	// Downscaling seldom reuses a source row for two output rows, so blending the two
+	// rows first (contiguous, vectorized) leaves one gathering pass per output row.
+	// Otherwise the horizontally resampled rows are cached and reused.
+	const bool vertical_first = plan.resized.height < plan.src.height;
+
+	// A team per call from threads that already run side by side would oversubscribe the cores
+	const int threads = (num_threads > 0) ? num_threads : omp_get_max_threads();
+	const bool parallel = threads > 1 && H >= 64 && !omp_in_parallel();
+
+	#pragma omp parallel num_threads(threads) if(parallel)
+	{
+		// vertical_first: one blended source row (interleaved BGR); otherwise two
+		// horizontally resampled source rows (planar RGB)
+		std::vector<float> cache(vertical_first ? size_t(3) * plan.src.width : size_t(6) * rw);
+		int cached[2] = { -1, -1 };
+
+		#pragma omp for schedule(static)
+		for (int y=0; y<H; y++) {
+			float *out[3] = { dst + y * size_t(W), dst + plane + y * size_t(W), dst + 2 * plane + y * size_t(W) };
+			int ry = y - plan.pad_y;
+			if (ry < 0 || ry >= plan.resized.height) {
+				for (int c=0; c<3; c++) {
+					std::fill(out[c], out[c] + W, pad[c]);
+				}
+				continue;
+			}
+			for (int c=0; c<3; c++) {
+				std::fill(out[c], out[c] + plan.pad_x, pad[c]);
+				std::fill(out[c] + plan.pad_x + rw, out[c] + W, pad[c]);
+				out[c] += plan.pad_x;
+			}
+			const int sy[2] = { plan.y0[ry], plan.y1[ry] };
+			const float w1 = plan.wy[ry];
+
+			if (vertical_first) {
+				blendRows(src + sy[0] * src_step, src + sy[1] * src_step, 3 * plan.src.width, 1.f - w1, w1, cache.data());
+				resampleBlended(cache.data(), plan, k, mean_scaled, out);
+				continue;
+			}
+
+			float *rows[2];
+			for (int i=0; i<2; i++) {
+				int slot = (cached[0] == sy[i]) ? 0 : (cached[1] == sy[i]) ? 1 : -1;
+				if (slot < 0) {
+					// Overwrite the slot that does not hold the other row
+					slot = (cached[0] == sy[1 - i]) ? 1 : 0;
+					float *row = &cache[size_t(3) * rw * slot];
+					resampleRow(src + sy[i] * src_step, plan, row, row + rw, row + 2 * rw);
+					cached[slot] = sy[i];
+				}
+				rows[i] = &cache[size_t(3) * rw * slot];
+			}
+
+			// Vertical pass, scaling and mean subtraction straight into the CHW planes
+			const float k0 = (1.f - w1) * k;
+			const float k1 = w1 * k;
+			for (int c=0; c<3; c++) {
+				const float *a = rows[0] + c * rw;
+				const float *b = rows[1] + c * rw;
+				float *o = out[c];
+				const float m = mean_scaled[c];
+				#pragma omp simd
+				for (int x=0; x<rw; x++) {
+					o[x] = a[x] * k0 + b[x] * k1 - m;
+				}
+			}
+		}
+	}
+}
+
+bool preprocess::toBlob(const cv::Mat &bgr, cv::Size net, bool letterbox, double scale, const cv::Scalar &mean, preprocess::Plan &plan, cv::Mat &blob, int num_threads)
+{
+	if (bgr.empty() || bgr.type() != CV_8UC3) {
+		return false;
+	}
+	if (!plan.matches(bgr.size(), net, letterbox)) {
+		makePlan(bgr.size(), net, letterbox, plan);
+	}
+	if (blob.dims != 4 || blob.size[1] != 3 || blob.size[2] != net.height || blob.size[3] != net.width) {
+		const int shape[4] = { 1, 3, net.height, net.width };
+		blob.create(4, shape, CV_32F);
+	}
+	run(bgr, plan, scale, mean, blob.ptr<float>(0), 127.5f, num_threads);
+	return true;
+}
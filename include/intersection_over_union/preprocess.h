@@ -0,0 +1,51 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <vector>
+#include <opencv4/opencv2/opencv.hpp>
+
+// Network input preparation in one pass: bilinear resize (optionally
+// letterboxed), BGR->RGB, (value - mean) * scale and HWC->CHW, written
+// straight into a float tensor. Replaces cv::dnn::blobFromImage, which runs
+// each step separately with its own temporary image.
+namespace preprocess {
+	// Interpolation tables for one source size / network size pair
+	struct Plan {
+		cv::Size src;
+		cv::Size net;
+		bool letterbox = false;
+		// Network pixels per source pixel, and where the image starts in the network input
+		double scale_x = 1.0, scale_y = 1.0;
+		int pad_x = 0, pad_y = 0;
+		cv::Size resized;
+		std::vector<int> x0, x1;				// byte offsets of the two source pixels of each column
+		std::vector<float> wx;					// weight of x1
+		std::vector<int> y0, y1;
+		std::vector<float> wy;
+
+		bool matches(cv::Size src_size, cv::Size net_size, bool use_letterbox) const {
+			return src == src_size && net == net_size && letterbox == use_letterbox;
+		}
+		// Box of normalized network coordinates in source pixels
+		cv::Rect toSource(float cx, float cy, float w, float h) const;
+	};
+
+	// Without letterbox the image is stretched to 'net', as blobFromImage does
+	void makePlan(cv::Size src, cv::Size net, bool letterbox, Plan &plan);
+
+	// 'bgr' must be CV_8UC3. 'dst' points to a 3 x net.height x net.width float
+	// slot, e.g. blob.ptr<float>(n) of an NCHW batch tensor. Letterbox borders
+	// get 'pad_value' (in 8-bit units). The values differ from blobFromImage by
+	// at most one 8-bit step, since no intermediate 8-bit image is rounded.
+	// Rows are split over 'num_threads' OpenMP threads (0: all). Callers that
+	// already run several images side by side (viewer prefetch workers, --serve
+	// workers) pass their share, 1 for the serial path; inside an OpenMP
+	// parallel region and for small inputs the serial path is always taken.
+	void run(const cv::Mat &bgr, const Plan &plan, double scale, const cv::Scalar &mean, float *dst, float pad_value = 127.5f, int num_threads = 0);
+
+	// Updates 'plan' if the sizes changed, (re)allocates 'blob' as a 1 x 3 x H x W
+	// tensor only when its shape changed, then fills it. False for images that are not CV_8UC3.
+	bool toBlob(const cv::Mat &bgr, cv::Size net, bool letterbox, double scale, const cv::Scalar &mean, Plan &plan, cv::Mat &blob, int num_threads = 0);
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "result_writer.h"
+#include <cstdio>
+#include <cstring>
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+	const char MAGIC[8] = {'I', 'O', 'U', 'R', 'E', 'S', '2', '\0'};
+	const size_t GROUP_ROWS = 64 * 1024;
+
+	template <typename T>
+	void writeValue(std::ofstream &out, const T &value) {
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T, typename Setter>
+	bool readColumn(std::ifstream &in, std::vector<ResultRecord> &rows, Setter setter) {
+		std::vector<T> column(rows.size());
+		in.read(reinterpret_cast<char*>(column.data()), column.size() * sizeof(T));
+		for (size_t i=0; i<rows.size(); i++) {
+			setter(rows[i], column[i]);
+		}
+		return bool(in);
+	}
+
+	template <typename T, typename Getter>
+	void writeColumn(std::ofstream &out, const std::vector<ResultRecord> &rows, Getter getter) {
+		std::vector<T> column(rows.size());
+		for (size_t i=0; i<rows.size(); i++) {
+			column[i] = getter(rows[i]);
+		}
+		out.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+	}
+}
+
+ResultWriter::ResultWriter()
+{
+	csv_open_ = false;
+	binary_open_ = false;
+	num_records_ = 0;
+}
+
+ResultWriter::~ResultWriter()
+{
+	this->close();
+}
+
+bool ResultWriter::open(std::string csv_file, std::string binary_file)
+{
+	this->close();
+	num_records_ = 0;
+	names_.clear();
+	if (csv_file != "") {
+		csv_buffer_.resize(1 << 20);
+		csv_.rdbuf()->pubsetbuf(&csv_buffer_[0], csv_buffer_.size());
+		csv_.open(csv_file.c_str(), std::ios::out | std::ios::trunc);
+		if (!csv_.is_open()) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot write results: " + csv_file);
+			return false;
+		}
+		csv_ << "image,label_class,detected_class,iou,confidence,matched\n";
+		csv_open_ = true;
+	}
+	if (binary_file != "") {
+		binary_.open(binary_file.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!binary_.is_open()) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot write results: " + binary_file);
+			return false;
+		}
+		binary_.write(MAGIC, sizeof(MAGIC));
+		group_.reserve(GROUP_ROWS);
+		binary_open_ = true;
+	}
+	return true;
+}
+
+void ResultWriter::write(uint32_t image, const std::string &name, const std::vector<ResultRecord> &records)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (image >= names_.size()) {
+		names_.resize(image + 1);
+	}
+	names_[image] = name;
+
+	// Quote names that would break the CSV columns
+	std::string csv_name = name;
+	if (name.find_first_of(",\"\n") != std::string::npos) {
+		csv_name = "\"";
+		for (size_t i=0; i<name.size(); i++) {
+			if (name[i] == '"') { csv_name.push_back('"'); }
+			csv_name.push_back(name[i]);
+		}
+		csv_name.push_back('"');
+	}
+
+	char line[64];
+	for (size_t i=0; i<records.size(); i++) {
+		const ResultRecord &r = records[i];
+		if (csv_open_) {
+			int n = std::snprintf(line, sizeof(line), ",%d,%d,%.4f,%.4f,%d\n", r.label_class, r.detected_class, r.iou, r.confidence, int(r.matched));
+			csv_ << csv_name;
+			csv_.write(line, n);
+		}
+		if (binary_open_) {
+			group_.push_back(r);
+			group_.back().image = image;
+			if (group_.size() >= GROUP_ROWS) {
+				this->flushGroup();
+			}
+		}
+	}
+	num_records_ += records.size();
+}
+
+void ResultWriter::flushGroup()
+{
+	if (group_.empty()) { return; }
+	writeValue(binary_, uint32_t(group_.size()));
+	writeColumn<uint32_t>(binary_, group_, [](const ResultRecord &r) { return r.image; });
+	writeColumn<int32_t>(binary_, group_, [](const ResultRecord &r) { return r.label_class; });
+	writeColumn<int32_t>(binary_, group_, [](const ResultRecord &r) { return r.detected_class; });
+	writeColumn<float>(binary_, group_, [](const ResultRecord &r) { return r.iou; });
+	writeColumn<float>(binary_, group_, [](const ResultRecord &r) { return r.confidence; });
+	writeColumn<uint8_t>(binary_, group_, [](const ResultRecord &r) { return r.matched; });
+	group_.clear();
+}
+
+void ResultWriter::close()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (csv_open_) {
+		csv_.close();
+		csv_open_ = false;
+	}
+	if (binary_open_) {
+		this->flushGroup();
+		writeValue(binary_, uint32_t(0));
+		uint64_t names_offset = uint64_t(binary_.tellp());
+		writeValue(binary_, uint32_t(names_.size()));
+		for (size_t i=0; i<names_.size(); i++) {
+			writeValue(binary_, uint32_t(names_[i].size()));
+			binary_.write(names_[i].data(), names_[i].size());
+		}
+		writeValue(binary_, names_offset);
+		binary_.write(MAGIC, sizeof(MAGIC));
+		binary_.close();
+		binary_open_ = false;
+	}
+}
+
+bool ResultReader::open(std::string binary_file)
+{
+	in_.close();
+	in_.clear();
+	in_.open(binary_file.c_str(), std::ios::in | std::ios::binary);
+	char magic[sizeof(MAGIC)];
+	if (!in_.is_open() || !in_.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+		// IOURES1 stored the class ids in 16 bits
+		bool old_version = in_.gcount() == sizeof(magic) && std::memcmp(magic, MAGIC, 6) == 0;
+		logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, (old_version ? "Results file of an older version, evaluate again: " : "Not a results file: ") + binary_file);
+		in_.close();
+		return false;
+	}
+	return true;
+}
+
+bool ResultReader::next(std::vector<ResultRecord> &rows)
+{
+	uint32_t count = 0;
+	if (!in_.is_open() || !in_.read(reinterpret_cast<char*>(&count), sizeof(count)) || count == 0) {
+		rows.clear();
+		return false;
+	}
+	rows.resize(count);
+	return readColumn<uint32_t>(in_, rows, [](ResultRecord &r, uint32_t v) { r.image = v; })
+		&& readColumn<int32_t>(in_, rows, [](ResultRecord &r, int32_t v) { r.label_class = v; })
+		&& readColumn<int32_t>(in_, rows, [](ResultRecord &r, int32_t v) { r.detected_class = v; })
+		&& readColumn<float>(in_, rows, [](ResultRecord &r, float v) { r.iou = v; })
+		&& readColumn<float>(in_, rows, [](ResultRecord &r, float v) { r.confidence = v; })
+		&& readColumn<uint8_t>(in_, rows, [](ResultRecord &r, uint8_t v) { r.matched = v; });
+}
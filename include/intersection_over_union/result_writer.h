@@ -0,0 +1,66 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One label/detection pair of an evaluated image. A label without a detection
+// has detected_class -1, a detection not covering any label has label_class -1.
+struct ResultRecord {
+	uint32_t image = 0;
+	int32_t label_class = -1;
+	int32_t detected_class = -1;
+	float iou = 0.f;
+	float confidence = 0.f;
+	uint8_t matched = 0;
+};
+
+// Streams result records to a CSV file and/or a columnar binary file.
+//
+// Binary layout (little endian):
+//   "IOURES2\0"
+//   row groups: uint32 rows, then the columns of those rows one after another
+//     uint32 image[rows], int32 label_class[rows], int32 detected_class[rows],
+//     float iou[rows], float confidence[rows], uint8 matched[rows]
+//   uint32 0 (end of row groups)
+//   image names: uint32 count, then per image uint32 length + bytes
+//   uint64 offset of the image names, "IOURES2\0"
+class ResultWriter {
+public:
+	ResultWriter();
+	~ResultWriter();
+	// Either file may be empty to skip that output
+	bool open(std::string csv_file, std::string binary_file);
+	bool isOpen() const { return csv_open_ || binary_open_; }
+	void write(uint32_t image, const std::string &name, const std::vector<ResultRecord> &records);
+	void close();
+	size_t numRecords() const { return num_records_; }
+
+private:
+	void flushGroup();
+
+	std::mutex mutex_;
+	std::ofstream csv_, binary_;
+	bool csv_open_, binary_open_;
+	std::vector<char> csv_buffer_;
+	std::vector<std::string> names_;
+	std::vector<ResultRecord> group_;
+	size_t num_records_;
+};
+
+// Reads the binary file of ResultWriter back, one row group at a time
+class ResultReader {
+public:
+	bool open(std::string binary_file);
+	// False after the last row group or on a truncated file
+	bool next(std::vector<ResultRecord> &rows);
+	void close() { in_.close(); }
+
+private:
+	std::ifstream in_;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "sampling.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+#include <utility>
+
+std::vector<int> sampling::order(const std::vector<int> &strata, uint32_t seed, bool stratified)
+{
+	std::mt19937 rng(seed);
+	std::vector<int> indices(strata.size());
+	for (size_t i=0; i<indices.size(); i++) {
+		indices[i] = int(i);
+	}
+	if (!stratified) {
+		std::shuffle(indices.begin(), indices.end(), rng);
+		return indices;
+	}
+
+	std::map<int, std::vector<int> > groups;
+	for (size_t i=0; i<strata.size(); i++) {
+		groups[strata[i]].push_back(int(i));
+	}
+	// Systematic interleaving: the j-th image of a stratum of size n gets the
+	// key (j + u) / n with one random offset u per stratum. Sorting by key
+	// spreads every stratum evenly over the whole order.
+	std::uniform_real_distribution<double> offset(0.0, 1.0);
+	std::vector<std::pair<double, int> > keyed;
+	keyed.reserve(strata.size());
+	std::map<int, std::vector<int> >::iterator it;
+	for (it = groups.begin(); it != groups.end(); it++) {
+		std::vector<int> &group = it->second;
+		std::shuffle(group.begin(), group.end(), rng);
+		double u = offset(rng);
+		for (size_t j=0; j<group.size(); j++) {
+			keyed.push_back(std::make_pair((j + u) / double(group.size()), group[j]));
+		}
+	}
+	std::sort(keyed.begin(), keyed.end());
+	for (size_t i=0; i<keyed.size(); i++) {
+		indices[i] = keyed[i].second;
+	}
+	return indices;
+}
+
+double sampling::normalQuantile(double confidence)
+{
+	// Bisection on the two-sided tail probability erfc(z / sqrt(2))
+	double alpha = 1.0 - confidence;
+	double lo = 0.0, hi = 10.0;
+	for (int i=0; i<100; i++) {
+		double mid = 0.5 * (lo + hi);
+		if (std::erfc(mid / std::sqrt(2.0)) > alpha) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return 0.5 * (lo + hi);
+}
+
+sampling::RunningInterval::RunningInterval(size_t population, double confidence)
+	: population_(population), z_(normalQuantile(confidence)), count_(0), mean_(0.0), m2_(0.0)
+{
+}
+
+void sampling::RunningInterval::add(double value)
+{
+	count_++;
+	double delta = value - mean_;
+	mean_ += delta / double(count_);
+	m2_ += delta * (value - mean_);
+}
+
+double sampling::RunningInterval::halfWidth() const
+{
+	if (count_ < 2) {
+		return std::numeric_limits<double>::infinity();
+	}
+	double variance = m2_ / double(count_ - 1);
+	double fpc = 1.0;
+	if (population_ > 1) {
+		fpc = std::max(0.0, (double(population_) - double(count_)) / double(population_ - 1));
+	}
+	return z_ * std::sqrt(variance / double(count_) * fpc);
+}
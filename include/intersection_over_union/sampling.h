@@ -0,0 +1,38 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sampled evaluation: visits the test set in a seeded random order and tracks
+// a confidence interval of the mean metric, so a run can stop early.
+namespace sampling {
+	// Random permutation of [0, strata.size()). With 'stratified', every prefix
+	// keeps the proportions of the strata (e.g. the dominant class of an image).
+	std::vector<int> order(const std::vector<int> &strata, uint32_t seed, bool stratified);
+
+	// z such that P(-z < X < z) = confidence for a standard normal X
+	double normalQuantile(double confidence);
+
+	// Running mean and variance (Welford) of a sample drawn without
+	// replacement from a population of 'population' values
+	class RunningInterval {
+	public:
+		RunningInterval(size_t population, double confidence);
+		void add(double value);
+		size_t count() const { return count_; }
+		double mean() const { return mean_; }
+		// Half width of the interval around mean(), with finite population correction
+		double halfWidth() const;
+
+	private:
+		size_t population_;
+		double z_;
+		size_t count_;
+		double mean_;
+		double m2_;
+	};
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "viewer_prefetcher.h"
+#include <algorithm>
+
+ViewerPrefetcher::ViewerPrefetcher(int num_images, int num_workers, int radius, size_t capacity, size_t budget_bytes, std::string spill_file, RenderFn render)
+{
+	num_images_ = num_images;
+	radius_ = std::max(radius, 0);
+	render_ = render;
+	// The window around the current image must fit, otherwise prefetched frames evict each other
+	cache_.open(budget_bytes, std::max(capacity, size_t(2 * radius_ + 1)), spill_file);
+	waiting_index_ = -1;
+	waiting_done_ = false;
+	stop_ = false;
+	for (int i=0; i<std::max(num_workers, 1); i++) {
+		workers_.push_back(std::thread(&ViewerPrefetcher::workerLoop, this, i));
+	}
+}
+
+ViewerPrefetcher::~ViewerPrefetcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+		queue_.clear();
+	}
+	work_cv_.notify_all();
+	for (size_t i=0; i<workers_.size(); i++) {
+		workers_[i].join();
+	}
+}
+
+RenderedFrame ViewerPrefetcher::get(int index)
+{
+	RenderedFrame frame;
+	// May read the frame back from the spill file, so it runs without the lock
+	bool cached = cache_.get(index, frame);
+	std::unique_lock<std::mutex> lock(mutex_);
+	// Workers put frames before taking the lock, a frame finished meanwhile is found here.
+	// Memory only: decoding a spilled frame would hold up the workers waiting for the lock.
+	if (!cached && !cache_.peekMemory(index, frame)) {
+		waiting_index_ = index;
+		waiting_done_ = false;
+		if (in_flight_.find(index) == in_flight_.end()) {
+			std::deque<int>::iterator it = std::find(queue_.begin(), queue_.end(), index);
+			if (it != queue_.end()) { queue_.erase(it); }
+			queue_.push_front(index);
+			work_cv_.notify_one();
+		}
+		done_cv_.wait(lock, [&]() { return waiting_done_ || stop_; });
+		frame = waiting_frame_;
+		waiting_index_ = -1;
+		waiting_frame_ = RenderedFrame();
+	}
+	this->schedule(index);
+	return frame;
+}
+
+// Called with mutex_ held. Pending work for the previous position is dropped,
+// nearest neighbours go first, the next image before the previous one.
+void ViewerPrefetcher::schedule(int center)
+{
+	queue_.clear();
+	for (int d=1; d<=radius_; d++) {
+		int candidates[2] = {(center + d) % num_images_, (center - d + num_images_ * d) % num_images_};
+		for (int k=0; k<2; k++) {
+			int index = candidates[k];
+			if (cache_.contains(index) || in_flight_.find(index) != in_flight_.end()) { continue; }
+			if (std::find(queue_.begin(), queue_.end(), index) != queue_.end()) { continue; }
+			queue_.push_back(index);
+		}
+	}
+	work_cv_.notify_all();
+}
+
+void ViewerPrefetcher::workerLoop(int worker)
+{
+	while (true) {
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			work_cv_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+			if (stop_) { return; }
+			index = queue_.front();
+			queue_.pop_front();
+			in_flight_.insert(index);
+		}
+
+		RenderedFrame frame;
+		render_(worker, index, frame);
+		// Before in_flight_ is cleared, so schedule() never sees the frame as missing
+		cache_.put(index, frame);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			in_flight_.erase(index);
+			if (index == waiting_index_) {
+				waiting_frame_ = frame;
+				waiting_done_ = true;
+			}
+		}
+		done_cv_.notify_all();
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef VIEWER_PREFETCHER_H
+#define VIEWER_PREFETCHER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv4/opencv2/opencv.hpp>
+#include "frame_cache.h"
+
+// Renders the frames around the current viewer position on background
+// threads and keeps the most recent ones in an LRU cache, so stepping through
+// the test set does not wait for inference. 'render' is called with the index
+// of the calling worker; each worker must own its own Detector. Frames evicted
+// from memory ('budget_bytes', 0: only 'capacity' frames) go to 'spill_file' if set.
+class ViewerPrefetcher {
+public:
+	typedef std::function<void(int worker, int index, RenderedFrame &frame)> RenderFn;
+
+	ViewerPrefetcher(int num_images, int num_workers, int radius, size_t capacity, size_t budget_bytes, std::string spill_file, RenderFn render);
+	~ViewerPrefetcher();
+
+	// Waits until frame 'index' is rendered, then prefetches its neighbours
+	RenderedFrame get(int index);
+
+	// Hit rate of get(), memory and spill use
+	void report() { cache_.report("viewer"); }
+
+private:
+	void schedule(int center);
+	void workerLoop(int worker);
+
+	int num_images_;
+	int radius_;
+	RenderFn render_;
+	std::mutex mutex_;
+	std::condition_variable work_cv_, done_cv_;
+	std::deque<int> queue_;
+	std::set<int> in_flight_;
+	FrameCache cache_;
+	int waiting_index_;
+	RenderedFrame waiting_frame_;
+	bool waiting_done_;
+	bool stop_;
+	std::vector<std::thread> workers_;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+namespace {
+	const size_t FLUSH_BYTES = 64 * 1024;
+
+	struct State {
+		std::atomic<int> level;
+		std::mutex mutex;
+		std::condition_variable wake_cv, flushed_cv;
+		std::string pending;
+		unsigned long long written_seq = 0;
+		unsigned long long pending_seq = 0;
+		bool running = false;
+		bool stopping = false;
+		bool flush_requested = false;
+		std::thread worker;
+
+		State() : level(logger::LOG_INFO) {}
+		// Works on *this only: state() must not be called again while the static is destroyed
+		~State() {
+			this->shutdown();
+		}
+
+		// Writes what is pending and joins the worker
+		void shutdown() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!running) { return; }
+				stopping = true;
+			}
+			wake_cv.notify_all();
+			worker.join();
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+			stopping = false;
+		}
+	};
+
+	State &state() {
+		static State instance;
+		return instance;
+	}
+
+	void workerLoop(State *state) {
+		State &s = *state;
+		std::string chunk;
+		std::unique_lock<std::mutex> lock(s.mutex);
+		while (true) {
+			// Wake up when enough text is buffered, on flush/stop, or every 50 ms
+			s.wake_cv.wait_for(lock, std::chrono::milliseconds(50), [&]() {
+				return s.stopping || s.flush_requested || s.pending.size() >= FLUSH_BYTES;
+			});
+			s.flush_requested = false;
+			if (!s.pending.empty()) {
+				chunk.swap(s.pending);
+				unsigned long long seq = s.pending_seq;
+				lock.unlock();
+				std::fwrite(chunk.data(), 1, chunk.size(), stdout);
+				std::fflush(stdout);
+				chunk.clear();
+				lock.lock();
+				s.written_seq = seq;
+				s.flushed_cv.notify_all();
+			}
+			if (s.stopping && s.pending.empty()) {
+				break;
+			}
+		}
+	}
+}
+
+void logger::start(logger::Level level)
+{
+	State &s = state();
+	s.level = level;
+	std::lock_guard<std::mutex> lock(s.mutex);
+	if (s.running) { return; }
+	std::fflush(stdout);
+	s.stopping = false;
+	s.running = true;
+	s.worker = std::thread(workerLoop, &s);
+}
+
+void logger::stop()
+{
+	state().shutdown();
+}
+
+void logger::flush()
+{
+	State &s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+	if (!s.running) {
+		std::fflush(stdout);
+		return;
+	}
+	unsigned long long target = s.pending_seq;
+	s.flush_requested = true;
+	s.wake_cv.notify_all();
+	s.flushed_cv.wait(lock, [&]() { return s.written_seq >= target || !s.running; });
+}
+
+void logger::setLevel(logger::Level level)
+{
+	state().level = level;
+}
+
+bool logger::enabled(logger::Level level)
+{
+	return level >= state().level && level != logger::LOG_OFF;
+}
+
+bool logger::parseLevel(std::string text, logger::Level &level)
+{
+	if (text == "debug") { level = logger::LOG_DEBUG; return true; }
+	if (text == "info") { level = logger::LOG_INFO; return true; }
+	if (text == "warn") { level = logger::LOG_WARN; return true; }
+	if (text == "error") { level = logger::LOG_ERROR; return true; }
+	if (text == "off") { level = logger::LOG_OFF; return true; }
+	return false;
+}
+
+void logger::write(logger::Level level, const std::string &text)
+{
+	if (!logger::enabled(level)) { return; }
+	State &s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+	if (!s.running) {
+		lock.unlock();
+		std::fwrite(text.data(), 1, text.size(), stdout);
+		std::fputc('\n', stdout);
+		return;
+	}
+	s.pending += text;
+	s.pending.push_back('\n');
+	s.pending_seq++;
+	if (s.pending.size() >= FLUSH_BYTES) {
+		s.wake_cv.notify_one();
+	}
+}
+
+logger::Line::Line(logger::Level level)
+{
+	level_ = level;
+	enabled_ = logger::enabled(level);
+}
+
+logger::Line::Line(logger::Line &&other) : stream_(std::move(other.stream_))
+{
+	level_ = other.level_;
+	enabled_ = other.enabled_;
+	other.enabled_ = false;
+}
+
+logger::Line::~Line()
+{
+	if (enabled_) {
+		logger::write(level_, stream_.str());
+	}
+}
+
+logger::Line logger::debug() { return logger::Line(logger::LOG_DEBUG); }
+logger::Line logger::info() { return logger::Line(logger::LOG_INFO); }
+logger::Line logger::warn() { return logger::Line(logger::LOG_WARN); }
+logger::Line logger::error() { return logger::Line(logger::LOG_ERROR); }
@@ -0,0 +1,48 @@
+#ifndef CPP_HELPERS_LOGGER_H
+#define CPP_HELPERS_LOGGER_H
+
+#include <sstream>
+#include <string>
+
+// Buffered console logging. Lines are appended to an in-memory buffer and
+// written to stdout in large chunks by a background thread, so the caller never
+// waits for the terminal. Before start() (or after stop()) lines are written
+// directly.
+namespace logger {
+	enum Level {LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF};
+
+	void start(Level level = LOG_INFO);
+	void stop();
+	// Blocks until everything logged so far has reached stdout
+	void flush();
+
+	void setLevel(Level level);
+	bool enabled(Level level);
+	bool parseLevel(std::string text, Level &level);
+
+	void write(Level level, const std::string &text);
+
+	// Collects one line, logged when the object goes out of scope
+	class Line {
+	public:
+		Line(Level level);
+		Line(Line &&other);
+		~Line();
+		template <typename T>
+		Line &operator<<(const T &value) {
+			if (enabled_) { stream_ << value; }
+			return *this;
+		}
+	private:
+		Level level_;
+		bool enabled_;
+		std::ostringstream stream_;
+	};
+
+	Line debug();
+	Line info();
+	Line warn();
+	Line error();
+};
+
+#endif
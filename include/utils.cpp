@@ -15,7 +15,10 @@
 #include <sys/types.h>
 #include <unistd.h>     //STDIN_FILENO
 
+#include <algorithm>
+#include <omp.h>
 #include <boost/filesystem.hpp>
+#include "logger.h"
 
 namespace fs = boost::filesystem;
 
@@ -60,6 +63,70 @@ void utils::findFiles(const std::string path, std::string filter, std::vector<st
 	}
 }
 
+namespace {
+	bool hasExtension(const std::string &path, const std::vector<std::string> &extensions) {
+		for (size_t i=0; i<extensions.size(); i++) {
+			const std::string &ext = extensions[i];
+			if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Files of one directory with a matching extension, and its sub-directories (symlinks not
+	// followed). An unreadable directory is reported and skipped, the caller keeps scanning.
+	void listDirectory(const std::string &dir, const std::vector<std::string> &extensions, std::vector<std::string> &files, std::vector<std::string> &subdirs) {
+		boost::system::error_code ec;
+		for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			const std::string &p = it->path().native();
+			boost::system::error_code status_ec;
+			if (fs::is_directory(it->symlink_status(status_ec))) {
+				subdirs.push_back(p);
+			} else if (hasExtension(p, extensions)) {
+				files.push_back(p);
+			}
+		}
+		if (ec) {
+			logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Skipped unreadable directory " + dir + ": " + ec.message());
+		}
+	}
+}
+
+void utils::scanFiles(const std::string path, const std::vector<std::string> &extensions, std::vector<std::string> &outputs)
+{
+	outputs.clear();
+	
+	// Expand the top of the tree breadth-first until there are enough directories to share out
+	std::vector<std::string> dirs(1, path);
+	int min_dirs = 4 * omp_get_max_threads();
+	for (int depth=0; depth<3 && (int)dirs.size() < min_dirs && !dirs.empty(); depth++) {
+		std::vector<std::string> next;
+		for (size_t i=0; i<dirs.size(); i++) {
+			listDirectory(dirs[i], extensions, outputs, next);
+		}
+		dirs.swap(next);
+	}
+	
+	std::vector<std::vector<std::string> > found(dirs.size());
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i=0; i<(int)dirs.size(); i++) {
+		// Explicit stack instead of recursive_directory_iterator, which ends the whole
+		// walk at the first directory it cannot open
+		std::vector<std::string> pending(1, dirs[i]);
+		while (!pending.empty()) {
+			std::string dir = pending.back();
+			pending.pop_back();
+			listDirectory(dir, extensions, found[i], pending);
+		}
+	}
+	
+	for (size_t i=0; i<found.size(); i++) {
+		outputs.insert(outputs.end(), found[i].begin(), found[i].end());
+	}
+	std::sort(outputs.begin(), outputs.end());
+}
+
 std::string utils::getStrId(int id, int N, char prefix)
 {
 	std::string text = std::to_string(id);
@@ -12,6 +12,10 @@ namespace utils {
 	
 	void findFiles(const std::string path, std::string filter, std::vector<std::string> &outputs);
 	
+	// Recursive search split over the sub-directories of 'path' with OpenMP.
+	// Returns the sorted paths ending with one of 'extensions'.
+	void scanFiles(const std::string path, const std::vector<std::string> &extensions, std::vector<std::string> &outputs);
+	
 	std::string getStrId(int id, int N, char prefix = '0');
 	
 	bool isValidPath(std::string path);
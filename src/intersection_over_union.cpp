@@ -1,10 +1,32 @@
 #include <iostream>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <omp.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <yaml-cpp/yaml.h>
 #include <opencv2/opencv.hpp>
 
 #include "utils.h"
 #include "intersection_over_union/common.h"
 #include "intersection_over_union/cvdnn_detector.h"
+#include "intersection_over_union/nms.h"
+#include "intersection_over_union/annotation_io.h"
+#include "intersection_over_union/dataset_store.h"
+#include "intersection_over_union/frame_cache.h"
+#include "intersection_over_union/lru_cache.h"
+#include "intersection_over_union/viewer_prefetcher.h"
+#include "intersection_over_union/result_writer.h"
+#include "intersection_over_union/perf_baseline.h"
+#include "intersection_over_union/eval_server.h"
+#include "intersection_over_union/sampling.h"
+#include "intersection_over_union/preprocess.h"
+#include "intersection_over_union/class_stats.h"
+#include "logger.h"
 
 namespace my_utils {
 	MyBox getValue(std::string text, std::string key, cv::Size image_size) {
@@ -64,16 +86,20 @@ namespace my_utils {
 
 class MyTools {
 public:
-	MyTools(std::string config_file) {
+	// 'dataset_only' (--serve, --export-annotations) reads the test set and the model parameters
+	// only: the result files and the log level of the config are left alone and detector_ is
+	// not loaded unless waitForModel() is called. 'keep_log_level' (set by --log-level) ignores
+	// output/log_level.
+	MyTools(std::string config_file, bool dataset_only = false, bool keep_log_level = false) : dataset_only_(dataset_only), keep_log_level_(keep_log_level) {
 		is_ok_ = this->loadConfig(config_file);
 	}
 	
 	bool loadConfig(std::string file) {
 		if (!utils::isValidPath(file)) {
-			std::cout << utils::colorText(TextType::DANGER_B, "Invalid file: " + file) << std::endl;
+			logger::error() << utils::colorText(TextType::DANGER_B, "Invalid file: " + file);
 			return false;
 		} else {
-			std::cout << "Reading file: " << file << std::endl;
+			logger::info() << "Reading file: " << file;
 		}
 		
 		// ### Reading header
@@ -84,54 +110,104 @@ public:
 		auto model = node[header2];
 		
 		if (!data) {
-			std::cout << " " << utils::colorText(TextType::DANGER_B, cv::format("Cannot find param '%s'", header.c_str())) << std::endl;
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Cannot find param '%s'", header.c_str()));
 			return false;
 		}
 
 		// ### Reading subfix
 		std::string subfix = "image_root";
 		if (!data[subfix]) {
-			std::cout << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str())) << std::endl;
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str()));
 			return false;
 		} else {
 			image_root_ = data[subfix].as<std::string>();
 			if (!utils::isValidPath(image_root_)) {
-				std::cout << " " << utils::colorText(TextType::DANGER_B, cv::format("Invalid path: %s", image_root_.c_str())) << std::endl;
+				logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Invalid path: %s", image_root_.c_str()));
 				return false;
 			}
-			std::cout << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str())) << std::endl;
+			logger::info() << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str()));
 		}
 		
 		std::string image_filetype(".png");
 		if (!data["image_filetype"]) {
-			std::cout << " " << utils::colorText(TextType::DANGER_B, "Image filetype was not defined") << std::endl;
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, "Image filetype was not defined");
 			return false;
 		}
 		image_filetype = data["image_filetype"].as<std::string>();
-		std::cout << " Successfully set filetype: " << utils::colorText(TextType::SUCCESS_B, image_filetype) << std::endl;
+		logger::info() << " Successfully set filetype: " << utils::colorText(TextType::SUCCESS_B, image_filetype);
 
-		// ### Reading subfix
+		// ### Startup is a small dependency graph: the class names gate the network, which is
+		// loaded and warmed up on a second thread while the test set is read on this one
+		startup_start_ = std::chrono::high_resolution_clock::now();
 		subfix = "meta_data_file";
-		if (!this->loadTestImageFilenames(data[subfix], image_filetype)) {
-			std::cout << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str())) << std::endl;
+		if (!this->loadAnnotations(data[subfix])) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str()));
 			return false;
 		} else {
-			std::cout << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str())) << std::endl;
+			logger::info() << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str()));
 		}
 		
-		// ### Reading subfix
-		if (!this->loadAnnotations(data[subfix])) {
-			std::cout << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str())) << std::endl;
+		if (!this->loadModel(model)) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s'", header2.c_str()));
 			return false;
 		} else {
-			std::cout << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str())) << std::endl;
+			logger::info() << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, header2);
 		}
+		auto t_classnames = std::chrono::high_resolution_clock::now();
 		
-		if (!this->loadModel(model)) {
-			std::cout << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str())) << std::endl;
+		// Evaluating modes overlap the network load with reading the test set
+		if (!dataset_only_) {
+			this->startModel();
+		}
+		
+		// ### Optional consolidated annotations, replaces the per-image label files
+		subfix = "annotations_file";
+		if (data[subfix]) {
+			if (!this->loadConsolidatedAnnotations(data[subfix].as<std::string>())) {
+				logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str()));
+				return false;
+			}
+			logger::info() << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str()));
+		}
+
+		// ### Reading subfix
+		subfix = "meta_data_file";
+		bool scan_image_root = data["scan_image_root"] ? data["scan_image_root"].as<bool>() : false;
+		bool dataset_ok = scan_image_root ? this->scanImageRoot(image_filetype) : this->loadTestImageFilenames(data[subfix], image_filetype);
+		if (!dataset_ok) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, cv::format("Failed loading param '%s/%s'", header.c_str(), subfix.c_str()));
 			return false;
 		} else {
-			std::cout << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str())) << std::endl;
+			logger::info() << " Successfully read params: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s/%s", header.c_str(), subfix.c_str()));
+		}
+		auto t_dataset = std::chrono::high_resolution_clock::now();
+		startup_ms_.classnames = std::chrono::duration<double, std::milli>(t_classnames - startup_start_).count();
+		startup_ms_.dataset = std::chrono::duration<double, std::milli>(t_dataset - t_classnames).count();
+		logger::info() << " |-- startup: " << utils::colorText(TextType::SUCCESS_B, cv::format("classnames %.1lf ms, dataset %.1lf ms%s", startup_ms_.classnames, startup_ms_.dataset, dataset_only_ ? "" : ", network still loading"));
+		
+		if (!this->loadViewerConfig(node["viewer"])) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, "Failed loading param 'viewer'");
+			return false;
+		}
+		
+		if (!dataset_only_ && !this->loadOutputConfig(node["output"])) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, "Failed loading param 'output'");
+			return false;
+		}
+		
+		if (!this->loadCacheConfig(node["cache"])) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, "Failed loading param 'cache'");
+			return false;
+		}
+		
+		if (!this->loadPerfConfig(node["perf"])) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, "Failed loading param 'perf'");
+			return false;
+		}
+		
+		if (!this->loadSampleConfig(node["sample"])) {
+			logger::error() << " " << utils::colorText(TextType::DANGER_B, "Failed loading param 'sample'");
+			return false;
 		}
 		
 		return true;
@@ -139,28 +215,64 @@ public:
 	
 	void run() {
 		if (!is_ok_) {
-			std::cout << utils::colorText(TextType::DANGER_B, "Failed setting config") << std::endl;
+			logger::error() << utils::colorText(TextType::DANGER_B, "Failed setting config");
 			return;
 		}
 		
 		int index = 0;
-		int N = int(test_images_.size());
+		int N = int(dataset_.size());
 		bool is_quit = false;
-		std::map<std::string, double> acc_list;
+		// Accuracy of the last visit per image, -1 until visited
+		std::vector<double> acc_list(N, -1.0);
+		int num_visited = 0;
 		int delay = 0;
-		while(!is_quit) {
-			MyImageInfo item = test_images_[index];			
-			std::cout << " [" << index << "] " << item.name << std::endl;
-			cv::Mat dst;
-			detector_.detect(item, dst);
-			double acc = this->computeIOU(item, dst);
+		int num_failed = 0;
+		
+		if (!this->waitForModel()) {
+			return;
+		}
+		
+		// Worker 0 uses detector_, the others get their own copy of the network
+		// Workers render side by side, each preprocesses on its share of the cores
+		int threads = std::max(1, omp_get_max_threads() / viewer_workers_);
+		detector_.setThreads(threads);
+		std::vector<Detector> detectors(viewer_workers_ - 1);
+		for (size_t i=0; i<detectors.size(); i++) {
+			this->initDetector(detectors[i]);
+			detectors[i].setThreads(threads);
+		}
+		ViewerPrefetcher prefetcher(N, viewer_workers_, viewer_radius_, viewer_cache_size_, cache_params_.budget_bytes, cache_params_.spill_file, [&](int worker, int index, RenderedFrame &frame) {
+			MyImageInfo item = dataset_.load(index, image_root_);
+			frame.name = item.name;
+			if (item.image.empty()) {
+				return;
+			}
+			Detector &detector = (worker == 0) ? detector_ : detectors[worker - 1];
+			detector.detect(item, frame.image);
+			frame.accuracy = this->computeIOU(item, frame.image, &frame.records, uint32_t(index));
 			
-			double scale = dst.cols /1000.0;
+			double scale = frame.image.cols /1000.0;
 			if (scale > 0) {
-				cv::resize(dst, dst, cv::Size(int(dst.cols / scale), int(dst.rows / scale)));
+				cv::resize(frame.image, frame.image, cv::Size(int(frame.image.cols / scale), int(frame.image.rows / scale)));
 			}
+			frame.ok = true;
+		});
+		
+		while(!is_quit) {
+			int shown = index;
+			RenderedFrame frame = prefetcher.get(shown);
+			this->reportStartup();
+			logger::info() << " [" << index << "] " << frame.name << (frame.ok ? cv::format("\tAccuracy: %.3lf", frame.accuracy) : "");
+			if (!frame.ok) {
+				logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Cannot read image: " + frame.name);
+				num_failed++;
+				is_quit = (num_failed >= N) || (delay > 0 && index + 1 == N);
+				index = (index + 1) % N;
+				continue;
+			}
+			num_failed = 0;
 			
-			cv::imshow("IOU", dst);
+			cv::imshow("IOU", frame.image);
 			char key = cv::waitKey(delay);
 			
 			if (key == '1') {
@@ -181,34 +293,340 @@ public:
 				}
 			}
 			
-			std::map<std::string, double>::iterator it = acc_list.find(item.name);
-			if (it == acc_list.end()) {
-				acc_list.insert(std::pair<std::string, double>(item.name, acc));
-			} else {
-				it->second = acc;
+			// 'index' has moved on already, the frame belongs to 'shown'
+			if (acc_list[shown] < 0) {
+				num_visited++;
+				results_.write(uint32_t(shown), frame.name, frame.records);
+				stats_.add(frame.records);
 			}
+			acc_list[shown] = frame.accuracy;
 		}
 		
+		prefetcher.report();
+		
 		double total_accuracy = 0.0;
-		std::map<std::string, double>::iterator it;
-		for (it = acc_list.begin(); it != acc_list.end(); it++) {
-			total_accuracy += it->second;
+		for (int i=0; i<N; i++) {
+			total_accuracy += std::max(0.0, acc_list[i]);
+		}
+		total_accuracy = total_accuracy / double(std::max(1, num_visited));
+		this->closeResults();
+		this->reportStats();
+		logger::info() << "\n----------------------------";
+		logger::info() << "Total accuracy of this model: " << total_accuracy;
+	}
+	
+	// Evaluates every image once without a window and writes the configured result files.
+	// With a 'recorder', the per-stage latencies of every image are recorded too.
+	bool runBatch(perf::Recorder *recorder = nullptr) {
+		if (!is_ok_) {
+			logger::error() << utils::colorText(TextType::DANGER_B, "Failed setting config");
+			return false;
+		}
+		
+		int N = int(dataset_.size());
+		double total_accuracy = 0.0;
+		int num_evaluated = 0;
+		auto t_start = std::chrono::high_resolution_clock::now();
+		
+		this->evaluate(detector_, [&](int index, const std::string &name, double acc, const std::vector<ResultRecord> &records) {
+			results_.write(uint32_t(index), name, records);
+			stats_.add(records);
+			logger::debug() << " [" << index << "] " << name << cv::format("\tAccuracy: %.3lf", acc);
+			if ((index + 1) % 1000 == 0 || index + 1 == N) {
+				double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+				logger::info() << " |-- evaluated: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d / %d images (%.1lf images/s)", index + 1, N, (index + 1) / elapsed));
+			}
+			return true;
+		}, total_accuracy, num_evaluated, recorder);
+		
+		images_.report("image");
+		this->closeResults();
+		this->reportStats();
+		logger::info() << "\n----------------------------";
+		logger::info() << "Total accuracy of this model: " << total_accuracy;
+		return num_evaluated > 0;
+	}
+	
+	typedef std::function<bool(int index, const std::string &name, double accuracy, const std::vector<ResultRecord> &records)> ImageFn;
+	
+	// Runs 'detector' over the test set, decoding the next image while the current one runs.
+	// 'on_image' is called after every evaluated image; returning false stops the evaluation.
+	// 'accuracy' receives the mean accuracy over the 'num_evaluated' readable images.
+	// A non-null 'order' lists the dataset indices to visit, otherwise all are visited in order.
+	bool evaluate(Detector &detector, ImageFn on_image, double &accuracy, int &num_evaluated, perf::Recorder *recorder = nullptr, const std::vector<int> *order = nullptr) {
+		int N = order ? int(order->size()) : int(dataset_.size());
+		double total_accuracy = 0.0;
+		bool completed = true;
+		num_evaluated = 0;
+		std::vector<ResultRecord> records;
+		
+		if (recorder) {
+			recorder->setStages({"decode", "preprocess", "forward", "postprocess", "iou", "total"});
+		}
+		
+		if (N == 0) {
+			accuracy = 0.0;
+			return true;
+		}
+		std::future<LoadedImage> next = std::async(std::launch::async, [this, order]() { return this->loadTimed(order ? (*order)[0] : 0); });
+		// detector_ may still be loading, the first image is decoded meanwhile
+		bool first_image = (&detector == &detector_);
+		if (first_image && !this->waitForModel()) {
+			return false;
+		}
+		for (int k=0; k<N; k++) {
+			int index = order ? (*order)[k] : k;
+			// Decoding overlaps the previous image, only the time spent waiting for it adds to 'total'
+			auto t_wait = std::chrono::high_resolution_clock::now();
+			LoadedImage loaded = next.get();
+			double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_wait).count();
+			MyImageInfo &item = loaded.item;
+			if (k + 1 < N) {
+				next = std::async(std::launch::async, [this, order, k]() { return this->loadTimed(order ? (*order)[k + 1] : k + 1); });
+			}
+			if (item.image.empty()) {
+				logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Cannot read image: " + item.path);
+				continue;
+			}
+			
+			cv::Mat dst;
+			detector.detect(item, dst);
+			auto t_iou = std::chrono::high_resolution_clock::now();
+			double acc = this->computeIOU(item, dst, &records, uint32_t(index));
+			double iou_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_iou).count();
+			if (recorder) {
+				const cvdnn_detector::Timing &timing = detector.lastTiming();
+				recorder->add(dataset_.key(index), {
+					loaded.decode_ms, timing.preprocess, timing.forward, timing.postprocess, iou_ms,
+					wait_ms + timing.total + iou_ms
+				});
+			}
+			total_accuracy += acc;
+			num_evaluated++;
+			if (first_image) {
+				first_image = false;
+				this->reportStartup();
+			}
+			
+			if (!on_image(index, item.name, acc, records)) {
+				completed = false;
+				break;
+			}
+		}
+		
+		accuracy = (num_evaluated > 0) ? total_accuracy / double(num_evaluated) : 0.0;
+		return completed;
+	}
+	
+	// Evaluates images in a seeded random (optionally class-stratified) order and stops once the
+	// confidence interval of the mean accuracy is narrower than the 'sample' config asks for
+	bool runSampled() {
+		if (!is_ok_) {
+			logger::error() << utils::colorText(TextType::DANGER_B, "Failed setting config");
+			return false;
+		}
+		
+		int N = int(dataset_.size());
+		std::vector<int> strata(N, -1);
+		if (sample_params_.stratified) {
+			for (int i=0; i<N; i++) {
+				strata[i] = this->dominantClass(i);
+			}
+		}
+		std::vector<int> order = sampling::order(strata, sample_params_.seed, sample_params_.stratified);
+		if (sample_params_.max_images > 0 && sample_params_.max_images < N) {
+			order.resize(sample_params_.max_images);
+		}
+		logger::info() << " |-- sampling: " << utils::colorText(TextType::SUCCESS_B, cv::format("seed %u, %s, stop at CI width %.4lf (%.0lf%%)", sample_params_.seed, sample_params_.stratified ? "class-stratified" : "uniform", sample_params_.ci_width, 100.0 * sample_params_.confidence));
+		
+		sampling::RunningInterval interval(size_t(N), sample_params_.confidence);
+		bool converged = false;
+		double accuracy = 0.0;
+		int num_evaluated = 0;
+		auto t_start = std::chrono::high_resolution_clock::now();
+		
+		this->evaluate(detector_, [&](int index, const std::string &name, double acc, const std::vector<ResultRecord> &records) {
+			results_.write(uint32_t(index), name, records);
+			stats_.add(records);
+			interval.add(acc);
+			logger::debug() << " [" << index << "] " << name << cv::format("\tAccuracy: %.3lf\tmean: %.4lf +- %.4lf", acc, interval.mean(), interval.halfWidth());
+			converged = int(interval.count()) >= sample_params_.min_images && 2.0 * interval.halfWidth() <= sample_params_.ci_width;
+			return !converged;
+		}, accuracy, num_evaluated, nullptr, &order);
+		
+		images_.report("image");
+		this->closeResults();
+		this->reportStats();
+		double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+		double half_width = interval.halfWidth();
+		logger::info() << " |-- sampled: " << utils::colorText(converged ? TextType::SUCCESS_B : TextType::WARNING_B, cv::format("%d / %d images in %.1lf s, %s", num_evaluated, N, elapsed, converged ? "interval reached the target" : "stopped before reaching the target"));
+		logger::info() << "\n----------------------------";
+		logger::info() << "Estimated accuracy of this model: " << cv::format("%.4lf +- %.4lf (%.0lf%% CI, %d images)", interval.mean(), std::isinf(half_width) ? 0.0 : half_width, 100.0 * sample_params_.confidence, num_evaluated);
+		return num_evaluated > 0;
+	}
+	
+	bool isOk() const { return is_ok_; }
+	
+	// Keeps decoded images between passes, within cache/cache_mb. Only worth it when the
+	// same test set is evaluated again (--serve): a single pass never reads one twice.
+	// No spill: reading the file again is cheaper than a PNG round trip.
+	void enableImageCache() {
+		if (cache_params_.budget_bytes > 0) {
+			images_.open(cache_params_.budget_bytes, 0);
 		}
-		total_accuracy = total_accuracy / double(acc_list.size());
-		std::cout << "\n----------------------------" << std::endl;
-		std::cout << "Total accuracy of this model: " << total_accuracy << std::endl;
+	}
+	
+	// Starts loading and warming up detector_ on a second thread, once
+	void startModel() {
+		std::call_once(model_once_, [this]() {
+			model_ready_ = std::async(std::launch::async, [this]() {
+				auto t0 = std::chrono::high_resolution_clock::now();
+				this->initDetector(detector_);
+				auto t1 = std::chrono::high_resolution_clock::now();
+				detector_.warmUp();
+				auto t2 = std::chrono::high_resolution_clock::now();
+				startup_ms_.model = std::chrono::duration<double, std::milli>(t1 - t0).count();
+				startup_ms_.warmup = std::chrono::duration<double, std::milli>(t2 - t1).count();
+				return true;
+			}).share();
+		});
+	}
+	
+	// Blocks until detector_ is loaded and warmed up (starting the load if needed); false if readNet failed
+	bool waitForModel() {
+		if (!is_ok_) {
+			return false;
+		}
+		this->startModel();
+		try {
+			return model_ready_.get();
+		} catch (const std::exception &e) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, std::string("Failed loading the network: ") + e.what());
+			return false;
+		}
+	}
+	
+	// Every viewer worker runs its own Detector, they all share the parameters of detector_.
+	// Non-empty 'weights_file' and 'cfg_file' replace the model of the config.
+	void initDetector(Detector &detector, std::string weights_file = "", std::string cfg_file = "") {
+		detector.init(
+			model_params_.width, model_params_.height,
+			weights_file != "" ? weights_file : model_params_.weights_file,
+			cfg_file != "" ? cfg_file : model_params_.cfg_file,
+			classnames_,
+			model_params_.conf, model_params_.nms
+		);
+		detector.setNmsOptions(model_params_.nms_mode, model_params_.nms_method, model_params_.nms_sigma);
+		detector.setLetterbox(model_params_.letterbox);
+	}
+	
+	// Negative thresholds fall back to the config
+	void setThresholds(Detector &detector, double conf_thr, double nms_thr) {
+		detector.setThresholds(conf_thr >= 0 ? conf_thr : model_params_.conf, nms_thr >= 0 ? nms_thr : model_params_.nms);
+	}
+	
+	// Records the stage latencies of one batch run into 'file'
+	bool runPerfBaseline(std::string file) {
+		perf::Recorder recorder;
+		if (!this->runBatch(&recorder)) {
+			return false;
+		}
+		recorder.meta()["weights_file"] = model_params_.weights_file;
+		recorder.meta()["cfg_file"] = model_params_.cfg_file;
+		recorder.meta()["net_size"] = cv::format("%dx%d", model_params_.width, model_params_.height);
+		recorder.meta()["opencv"] = CV_VERSION;
+		if (!recorder.save(file)) {
+			return false;
+		}
+		logger::info() << " |-- perf baseline: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images written to %s", int(recorder.images().size()), file.c_str()));
+		return true;
+	}
+	
+	// Reruns the batch and compares it with the baseline in 'file'. Returns 0 when
+	// no stage got slower than the tolerances of the 'perf' config, 1 on a regression
+	// and -1 on errors.
+	int runPerfCompare(std::string file) {
+		perf::Recorder baseline;
+		if (!baseline.load(file)) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot load perf baseline: " + file);
+			return -1;
+		}
+		perf::Recorder current;
+		if (!this->runBatch(&current)) {
+			return -1;
+		}
+		if (baseline.images() != current.images()) {
+			logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, cv::format("Test set differs from the baseline (%d vs %d images)", int(current.images().size()), int(baseline.images().size())));
+		}
+		
+		std::vector<perf::StageReport> reports = perf::compare(baseline, current, perf_tolerance_);
+		if (reports.empty()) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "No stage in common with the baseline");
+			return -1;
+		}
+		bool regressed = false;
+		logger::info() << cv::format(" %-12s %21s %26s %21s %26s", "stage", "median (ms)", "ratio CI", "p99 (ms)", "ratio CI");
+		for (size_t i=0; i<reports.size(); i++) {
+			const perf::StageReport &r = reports[i];
+			std::string line = cv::format(" %-12s %9.3lf -> %9.3lf   [%5.3lf, %5.3lf] x   %9.3lf -> %9.3lf   [%5.3lf, %5.3lf] x",
+				r.stage.c_str(), r.base_median, r.median, r.median_lo, r.median_hi, r.base_p99, r.p99, r.p99_lo, r.p99_hi);
+			logger::info() << utils::colorText(r.regressed ? TextType::DANGER_B : TextType::SUCCESS_B, line);
+			regressed = regressed || r.regressed;
+		}
+		if (regressed) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, cv::format("Performance regression (tolerance: median +%.0lf%%, p99 +%.0lf%%)", 100.0 * perf_tolerance_.median, 100.0 * perf_tolerance_.p99));
+			return 1;
+		}
+		logger::info() << " |-- " << utils::colorText(TextType::SUCCESS_B, "No performance regression");
+		return 0;
+	}
+	
+	// Writes the per-image darknet labels of the test set into one consolidated file
+	bool exportAnnotations(std::string file) {
+		if (!is_ok_) {
+			logger::error() << utils::colorText(TextType::DANGER_B, "Failed setting config");
+			return false;
+		}
+		
+		logger::info() << " Exporting annotations: " << utils::colorText(TextType::SUCCESS_B, file);
+		annotation_io::Writer writer;
+		if (!writer.open(file, classnames_)) {
+			return false;
+		}
+		bool need_size = (annotation_io::formatFromPath(file) == annotation_io::COCO_JSON);
+		for (size_t i=0; i<dataset_.size(); i++) {
+			annotation_io::ImageAnnotations image;
+			image.path = dataset_.key(i);
+			cv::Size size = dataset_.imageSize(i);
+			if (need_size && size.area() == 0) {
+				// COCO boxes are in pixels, decode once for images without a known size
+				size = cv::imread(image_root_ + "/" + image.path, cv::IMREAD_COLOR).size();
+			}
+			image.width = size.width;
+			image.height = size.height;
+			dataset_.annotations(i, image.boxes);
+			writer.add(image);
+		}
+		return writer.close();
 	}
 	
 private:
 	
-	double computeIOU(MyImageInfo item, cv::Mat &image) {
+	// 'records' receives one entry per label (matched or missed) and per unmatched detection
+	double computeIOU(MyImageInfo item, cv::Mat &image, std::vector<ResultRecord> *records = nullptr, uint32_t image_index = 0) {
 		int fontface = cv::FONT_HERSHEY_SIMPLEX;
     double fontscale = 0.5;
     int thickness = 1;
 		
+		std::vector<char> used(item.detections.size(), 0);
+		if (records) {
+			records->clear();
+		}
+		
 		if (item.detections.size() == 0 || item.labels.size() == 0) {
-			std::cout << " -- Invalid box size. Labels: " << int(item.labels.size()) << ", Detected: " << int(item.detections.size()) << std::endl;
+			logger::debug() << " -- Invalid box size. Labels: " << int(item.labels.size()) << ", Detected: " << int(item.detections.size());
 			cv::putText(image, "Invalid detections", cv::Point(10, image.rows - 10), fontface, fontscale, cv::Scalar(0, 0, 255), thickness);
+			this->addUnmatchedRecords(item, used, image_index, records);
 			return false;
 		}
 		
@@ -220,6 +638,7 @@ private:
 			int cx = item.labels[i].cx;
 			int cy = item.labels[i].cy;
 			int detected_id = -1;
+			int detected_index = -1;
 			cv::Rect detected_box;
 			for (int k=0; k<(int)item.detections.size() && detected_id == -1; k++) {
 				auto detected = item.detections[k].box;
@@ -227,11 +646,20 @@ private:
 						&& cy >= detected.y && cy < detected.y + detected.height
 				) {
 					detected_id = item.detections[k].id;
+					detected_index = k;
 					detected_box = item.detections[k].box;
 				}
 			}
 			
-			if (detected_id >= 0) {
+			if (detected_id < 0) {
+				// Missed label
+				if (records) {
+					ResultRecord record;
+					record.image = image_index;
+					record.label_class = int32_t(item.labels[i].id);
+					records->push_back(record);
+				}
+			} else {
 				auto defined_box = item.labels[i].box;
 				
 				cv::Rect overlap_rect = my_utils::overlappingRect(defined_box, detected_box);
@@ -239,6 +667,17 @@ private:
 				
 				double union_area = my_utils::unionRectArea(defined_box, detected_box, overlap_rect);
 				double accuracy = double(overlap_rect.area()) / union_area;
+				if (records) {
+					ResultRecord record;
+					record.image = image_index;
+					record.label_class = int32_t(item.labels[i].id);
+					record.detected_class = int32_t(detected_id);
+					record.iou = float(accuracy);
+					record.confidence = item.detections[detected_index].confidence;
+					record.matched = 1;
+					records->push_back(record);
+				}
+				used[detected_index] = 1;
 				accuracy = (detected_id == item.labels[i].id) ? accuracy : 0.0;
 				
 				total_accuracy += accuracy;
@@ -260,27 +699,53 @@ private:
 			total_accuracy = total_accuracy / (double)total_num;
 			cv::putText(image, cv::format( "Prediction accuracy: %.2lf", total_accuracy), cv::Point(10, image.rows - 10), fontface, 0.8, cv::Scalar(0, 0, 255), 2);
 		}
-		std::cout << "    Accuracy: " << utils::colorText(TextType::SUCCESS_B, cv::format("%.3lf", total_accuracy)) << std::endl;
+		logger::debug() << "    Accuracy: " << utils::colorText(TextType::SUCCESS_B, cv::format("%.3lf", total_accuracy));
 		
+		this->addUnmatchedRecords(item, used, image_index, records);
 		return total_accuracy;
 	}
 	
+	void addUnmatchedRecords(const MyImageInfo &item, const std::vector<char> &used, uint32_t image_index, std::vector<ResultRecord> *records) {
+		if (!records) {
+			return;
+		}
+		// Labels are only all unmatched when nothing was compared
+		if (item.detections.empty()) {
+			for (size_t i=0; i<item.labels.size(); i++) {
+				if (!item.labels[i].isOk()) { continue; }
+				ResultRecord record;
+				record.image = image_index;
+				record.label_class = int32_t(item.labels[i].id);
+				records->push_back(record);
+			}
+		}
+		// Detections not covering any label centre are false positives
+		for (size_t k=0; k<item.detections.size(); k++) {
+			if (used[k]) { continue; }
+			ResultRecord record;
+			record.image = image_index;
+			record.detected_class = int32_t(item.detections[k].id);
+			record.confidence = item.detections[k].confidence;
+			records->push_back(record);
+		}
+	}
+	
 	bool loadTestImageFilenames(YAML::Node node, std::string image_filetype) {
 				
 		if (image_root_ == "") {
-			std::cout << " -- " << utils::colorText(TextType::DANGER_B, "image_root_ cannot be empty") << std::endl;
+			logger::error() << " -- " << utils::colorText(TextType::DANGER_B, "image_root_ cannot be empty");
 			return false;
 		}
 		
 		std::string path = node.as<std::string>();
 		if (!utils::isValidPath(path)) {
-			std::cout << " |-- Invalid path: " << utils::colorText(TextType::DANGER_B, path) << std::endl;
+			logger::error() << " |-- Invalid path: " << utils::colorText(TextType::DANGER_B, path);
 			return false;
 		}
 		
 		std::ifstream reader;
 		reader.open(path);
-		std::cout << "Reading a file " << utils::colorText(TextType::SUCCESS_B, path) << std::endl;
+		logger::info() << "Reading a file " << utils::colorText(TextType::SUCCESS_B, path);
 		std::string filename = "";
 		if (reader.is_open()) {
 			std::string line;
@@ -302,39 +767,32 @@ private:
 		}
 
 		if (filename == "") {
-			std::cout << " -- " << utils::colorText(TextType::DANGER_B, "Path for 'test.txt' cannot be empty") << std::endl;
+			logger::error() << " -- " << utils::colorText(TextType::DANGER_B, "Path for 'test.txt' cannot be empty");
 			return false;
 		} else {
-			std::cout << "Test image filename: " << filename << std::endl;
+			logger::info() << "Test image filename: " << filename;
 			if (!utils::isValidPath(filename)) {
-				std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + filename) << std::endl;
+				logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + filename);
 				return false;
 			} else {
-				std::cout << " |-- test_file: " << utils::colorText(TextType::SUCCESS_B, filename) << std::endl; 
-				std::cout << " |-- test_file_prefix: " << utils::colorText(TextType::SUCCESS_B, test_file_prefix_) << std::endl; 
+				logger::info() << " |-- test_file: " << utils::colorText(TextType::SUCCESS_B, filename);
+				logger::info() << " |-- test_file_prefix: " << utils::colorText(TextType::SUCCESS_B, test_file_prefix_);
 			}
 		}
 		
 		reader.open(filename);
 		if (reader.is_open()) {
 			std::string line;
+			std::vector<annotation_io::Annotation> labels;
 			while (std::getline(reader, line)) {
 				if (line.size() > 0) {
-					MyImageInfo item;
-					bool done = false;
-					for (int i=line.size() - 1; i>=0 && !done; i--) {
-						if (line[i] == '/') {
-							done = true;
-							item.name = line.substr(i + 1, line.size() - i - 1);
-						}
-					}
-					item.path = image_root_ + "/" + line;
-					item.image = cv::imread(item.path, cv::IMREAD_COLOR);
-					std::cout << "Name: " << item.name << "\t(Size: " << item.image.cols << "x" << item.image.rows << ")" << std::endl;
-					if (!item.image.empty()) {
-						item.labels = this->getBoundingBox(item.path, image_filetype, item.image.size());
-						test_images_.push_back(item);
+					cv::Size size;
+					if (use_consolidated_) {
+						this->getConsolidatedLabels(line, labels, size);
+					} else {
+						labels = this->getLabels(image_root_ + "/" + line, image_filetype);
 					}
+					this->addDatasetImage(line, labels, size);
 				}
 			}
 			reader.close();
@@ -342,44 +800,164 @@ private:
 			return false;
 		}
 		
-		if (test_images_.size() == 0) {
-			std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot find any images from " + filename) << std::endl;
+		// The consolidated file is fully copied into the store
+		annotations_.clear();
+		annotation_names_.clear();
+		
+		if (dataset_.size() == 0) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot find any images from " + filename);
 			return false;
 		}
 		
-		std::cout << " |-- test_images: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images", int(test_images_.size()))) << std::endl; 
+		logger::info() << " |-- test_images: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images", int(dataset_.size())));
+		logger::info() << " |-- labels: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d boxes, %.2lf MB in memory", int(dataset_.numLabels()), dataset_.memoryBytes() / (1024.0 * 1024.0)));
 		
 		return true;
 	}
 	
-	std::vector<MyBox> getBoundingBox(std::string image_filename, std::string filetype, cv::Size image_size) {
-		std::vector<MyBox> boxes;
-		std::size_t found = image_filename.find(filetype);
-		if (found != std::string::npos) {
-			std::string label_filename = image_filename.substr(0, int(found)) + ".txt";
-			if (utils::isValidPath(label_filename)) {
-				std::ifstream reader;
-				reader.open(label_filename);
-				if (reader.is_open()) {
-					std::string line;
-					while (std::getline(reader, line)) {
-						if (line != "") {
-							MyBox item = my_utils::getValue(line, " ", image_size);
-							if (item.id >= 0 && item.box.width > 0 && item.box.height > 0) {
-								boxes.push_back(item);
-							}
-						}
-					}
+	// Builds the test set from every image below image_root_, without a darknet test.txt
+	bool scanImageRoot(std::string image_filetype) {
+		if (image_root_ == "") {
+			logger::error() << " -- " << utils::colorText(TextType::DANGER_B, "image_root_ cannot be empty");
+			return false;
+		}
+		
+		auto t_start = std::chrono::high_resolution_clock::now();
+		std::vector<std::string> files;
+		std::vector<std::string> extensions;
+		extensions.push_back(image_filetype);
+		extensions.push_back(".txt");
+		utils::scanFiles(image_root_, extensions, files);
+		
+		// Images are paired with labels found by the same scan, so no exists() call per file
+		std::vector<std::string> images;
+		std::unordered_set<std::string> label_files;
+		for (size_t i=0; i<files.size(); i++) {
+			if (files[i].size() >= image_filetype.size() && files[i].compare(files[i].size() - image_filetype.size(), image_filetype.size(), image_filetype) == 0) {
+				images.push_back(files[i]);
+			} else {
+				label_files.insert(files[i]);
+			}
+		}
+		std::vector<std::string>().swap(files);
+		auto t_scan = std::chrono::high_resolution_clock::now();
+		
+		std::vector<std::vector<annotation_io::Annotation> > labels(images.size());
+		if (!use_consolidated_) {
+			#pragma omp parallel for schedule(dynamic, 64)
+			for (int i=0; i<(int)images.size(); i++) {
+				std::string label_file = images[i].substr(0, images[i].size() - image_filetype.size()) + ".txt";
+				if (label_files.count(label_file) > 0) {
+					labels[i] = annotation_io::readYoloFile(label_file);
 				}
 			}
 		}
-		return boxes;
+		
+		dataset_.reserve(images.size(), 0);
+		for (size_t i=0; i<images.size(); i++) {
+			std::string key = images[i];
+			if (key.compare(0, image_root_.size(), image_root_) == 0) {
+				key = key.substr(image_root_.size());
+			}
+			while (!key.empty() && key[0] == '/') {
+				key = key.substr(1);
+			}
+			cv::Size size;
+			if (use_consolidated_) {
+				this->getConsolidatedLabels(key, labels[i], size);
+			}
+			this->addDatasetImage(key, labels[i], size);
+			std::vector<annotation_io::Annotation>().swap(labels[i]);
+		}
+		annotations_.clear();
+		annotation_names_.clear();
+		
+		if (dataset_.size() == 0) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot find any '" + image_filetype + "' images in " + image_root_);
+			return false;
+		}
+		
+		auto t_end = std::chrono::high_resolution_clock::now();
+		logger::info() << " |-- scanned: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images, %d label files in %.1lf ms (labels read in %.1lf ms)",
+			int(images.size()), int(label_files.size()),
+			std::chrono::duration<double, std::milli>(t_scan - t_start).count(),
+			std::chrono::duration<double, std::milli>(t_end - t_scan).count()));
+		logger::info() << " |-- test_images: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images", int(dataset_.size())));
+		logger::info() << " |-- labels: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d boxes, %.2lf MB in memory", int(dataset_.numLabels()), dataset_.memoryBytes() / (1024.0 * 1024.0)));
+		return true;
+	}
+	
+	// Pixels are decoded on demand, only the path and labels are kept
+	void addDatasetImage(const std::string &key, const std::vector<annotation_io::Annotation> &labels, cv::Size size) {
+		size_t index = dataset_.addImage(key);
+		dataset_.setImageSize(index, size);
+		for (size_t i=0; i<labels.size(); i++) {
+			dataset_.addLabel(labels[i]);
+		}
+		logger::debug() << "Name: " << dataset_.name(index) << "\t(Labels: " << int(labels.size()) << ")";
+	}
+	
+	std::vector<annotation_io::Annotation> getLabels(std::string image_filename, std::string filetype) {
+		std::vector<annotation_io::Annotation> labels;
+		std::size_t found = image_filename.find(filetype);
+		if (found != std::string::npos) {
+			// A missing label file simply yields no labels, no separate exists() check
+			labels = annotation_io::readYoloFile(image_filename.substr(0, int(found)) + ".txt");
+		}
+		return labels;
 	}
 
+	bool loadConsolidatedAnnotations(std::string file) {
+		if (!utils::isValidPath(file)) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + file);
+			return false;
+		}
+		
+		auto t_start = std::chrono::high_resolution_clock::now();
+		int num_boxes = 0;
+		bool ok = annotation_io::read(file, [&](annotation_io::ImageAnnotations &image) {
+			std::size_t found = image.path.rfind('/');
+			std::string name = (found == std::string::npos) ? image.path : image.path.substr(found + 1);
+			std::pair<std::unordered_map<std::string, std::string>::iterator, bool> added = annotation_names_.insert(std::make_pair(name, image.path));
+			if (!added.second && added.first->second != image.path) {
+				logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Same file name in the annotations, lookups by name use the first one: " + added.first->second + ", " + image.path);
+			}
+			num_boxes += int(image.boxes.size());
+			annotations_[image.path] = std::move(image);
+		});
+		if (!ok) {
+			return false;
+		}
+		use_consolidated_ = true;
+		
+		auto t_end = std::chrono::high_resolution_clock::now();
+		double elapsed = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+		logger::info() << " |-- annotations: " << utils::colorText(TextType::SUCCESS_B, file);
+		logger::info() << " |-- loaded: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d images, %d boxes in %.1lf ms", int(annotations_.size()), num_boxes, elapsed));
+		return true;
+	}
+	
+	// Labels of one image from the consolidated file, looked up by its test.txt path, then by file name
+	void getConsolidatedLabels(std::string key, std::vector<annotation_io::Annotation> &labels, cv::Size &size) {
+		labels.clear();
+		std::unordered_map<std::string, annotation_io::ImageAnnotations>::iterator it = annotations_.find(key);
+		if (it == annotations_.end()) {
+			std::size_t found = key.rfind('/');
+			std::string name = (found == std::string::npos) ? key : key.substr(found + 1);
+			std::unordered_map<std::string, std::string>::iterator it2 = annotation_names_.find(name);
+			if (it2 == annotation_names_.end()) {
+				return;
+			}
+			it = annotations_.find(it2->second);
+		}
+		labels = it->second.boxes;
+		size = cv::Size(it->second.width, it->second.height);
+	}
+	
 	bool loadAnnotations(YAML::Node node) {
 		std::string path = node.as<std::string>();
 		if (!utils::isValidPath(path)) {
-			std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + path) << std::endl;
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + path);
 			return false;
 		}
 		
@@ -404,14 +982,14 @@ private:
 		}
 		
 		if (filename == "") {
-			std::cout << " -- " << utils::colorText(TextType::DANGER_B, "Path for '.names' cannot be empty") << std::endl;
+			logger::error() << " -- " << utils::colorText(TextType::DANGER_B, "Path for '.names' cannot be empty");
 			return false;
 		} else {
 			if (!utils::isValidPath(filename)) {
-				std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + filename) << std::endl;
+				logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + filename);
 				return false;
 			} else {
-				std::cout << " |-- annotations_file: " << utils::colorText(TextType::SUCCESS_B, filename) << std::endl; 
+				logger::info() << " |-- annotations_file: " << utils::colorText(TextType::SUCCESS_B, filename);
 			}
 		}
 		
@@ -431,7 +1009,7 @@ private:
 		}
 		
 		if (classnames_.size() == 0) {
-			std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot find any classname from " + filename) << std::endl;
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Cannot find any classname from " + filename);
 			return false;
 		}
 		
@@ -441,7 +1019,7 @@ private:
 			ss << "[" << it->second << "] ";
 		}
 		
-		std::cout << " |-- classnames: " << utils::colorText(TextType::SUCCESS_B, ss.str()) << std::endl; 
+		logger::info() << " |-- classnames: " << utils::colorText(TextType::SUCCESS_B, ss.str());
 		
 		return true;
 	}
@@ -451,18 +1029,18 @@ private:
 		std::string cfg_file = node["cfg_file"] ? node["cfg_file"].as<std::string>() : "";
 		
 		if (weights_file == "" || cfg_file == "") {
-			std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for weights_file or cfg_file") << std::endl;
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for weights_file or cfg_file");
 			return false;
 		} else {
 			if (!utils::isValidPath(weights_file) || !utils::isValidPath(cfg_file)) {
-				std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path for weights_file or cfg_file") << std::endl;
+				logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path for weights_file or cfg_file");
 				return false;
 			}
 		}
 		
 		int width, height;
 		if (!node["net_width"] || !node["net_height"]) {
-			std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for net_width or net_height") << std::endl;
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for net_width or net_height");
 			return false;
 		} else {
 			width = node["net_width"].as<int>();
@@ -471,38 +1049,440 @@ private:
 		
 		double conf, nms;
 		if (!node["confidence_thr"] || !node["nms_thr"]) {
-			std::cout << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for confidence_thr or nms_thr") << std::endl;
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for confidence_thr or nms_thr");
 			return false;
 		} else {
 			conf = node["confidence_thr"].as<double>();
 			nms = node["nms_thr"].as<double>();
 		}
 		
-		std::cout << " Loading YOLO model" << std::endl;
-		std::cout << " |-- weights: " << utils::colorText(TextType::SUCCESS_B, weights_file) << std::endl; 
-		std::cout << " |-- cfg: " << utils::colorText(TextType::SUCCESS_B, cfg_file) << std::endl; 
-		std::cout << " |-- net size: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d x %d", width, height)) << std::endl; 
-		std::cout << " |-- confidence threshold: " << utils::colorText(TextType::SUCCESS_B, std::to_string(conf)) << std::endl; 
-		std::cout << " |-- nms threshold: " << utils::colorText(TextType::SUCCESS_B, std::to_string(nms)) << std::endl; 
+		logger::info() << " Loading YOLO model";
+		logger::info() << " |-- weights: " << utils::colorText(TextType::SUCCESS_B, weights_file);
+		logger::info() << " |-- cfg: " << utils::colorText(TextType::SUCCESS_B, cfg_file);
+		logger::info() << " |-- net size: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d x %d", width, height));
+		logger::info() << " |-- confidence threshold: " << utils::colorText(TextType::SUCCESS_B, std::to_string(conf));
+		logger::info() << " |-- nms threshold: " << utils::colorText(TextType::SUCCESS_B, std::to_string(nms));
 		
-		detector_.init(
-			width, height,
-			weights_file, cfg_file, 
-			classnames_,
-			conf, nms
-		);
+		// Optional NMS behaviour, defaults to per-class hard NMS
+		std::string nms_mode_text = node["nms_mode"] ? node["nms_mode"].as<std::string>() : "class_agnostic";
+		std::string nms_method_text = node["nms_method"] ? node["nms_method"].as<std::string>() : "hard";
+		double nms_sigma = node["soft_nms_sigma"] ? node["soft_nms_sigma"].as<double>() : 0.5;
+		nms::Mode nms_mode;
+		nms::Method nms_method;
+		if (!nms::parseMode(nms_mode_text, nms_mode) || !nms::parseMethod(nms_method_text, nms_method)) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for nms_mode or nms_method");
+			return false;
+		}
+		if (nms_method != nms::HARD && nms_sigma <= 0.0) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for soft_nms_sigma");
+			return false;
+		}
+		logger::info() << " |-- nms: " << utils::colorText(TextType::SUCCESS_B, nms_mode_text + ", " + nms_method_text);
+		
+		bool letterbox = node["letterbox"] ? node["letterbox"].as<bool>() : false;
+		logger::info() << " |-- resize: " << utils::colorText(TextType::SUCCESS_B, letterbox ? "letterbox" : "stretch");
+		
+		model_params_.width = width;
+		model_params_.height = height;
+		model_params_.weights_file = weights_file;
+		model_params_.cfg_file = cfg_file;
+		model_params_.conf = conf;
+		model_params_.nms = nms;
+		model_params_.nms_mode = nms_mode;
+		model_params_.nms_method = nms_method;
+		model_params_.nms_sigma = nms_sigma;
+		model_params_.letterbox = letterbox;
 		
 		return true;
 	}
 	
+	bool loadViewerConfig(YAML::Node node) {
+		if (!node) {
+			return true;
+		}
+		viewer_radius_ = node["prefetch_radius"] ? node["prefetch_radius"].as<int>() : viewer_radius_;
+		viewer_workers_ = node["prefetch_workers"] ? node["prefetch_workers"].as<int>() : viewer_workers_;
+		viewer_cache_size_ = node["cache_size"] ? node["cache_size"].as<int>() : viewer_cache_size_;
+		if (viewer_radius_ < 0 || viewer_workers_ < 1 || viewer_cache_size_ < 1) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for prefetch_radius, prefetch_workers or cache_size");
+			return false;
+		}
+		logger::info() << " |-- viewer: " << utils::colorText(TextType::SUCCESS_B, cv::format("prefetch %d images around the current one on %d workers, cache %d frames", viewer_radius_, viewer_workers_, viewer_cache_size_));
+		return true;
+	}
+	
+	bool loadOutputConfig(YAML::Node node) {
+		if (!node) {
+			return true;
+		}
+		if (node["log_level"]) {
+			logger::Level level;
+			if (!logger::parseLevel(node["log_level"].as<std::string>(), level)) {
+				logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for log_level (debug, info, warn, error, off)");
+				return false;
+			}
+			if (!keep_log_level_) {
+				logger::setLevel(level);
+			}
+		}
+		
+		stats_file_ = node["stats_file"] ? node["stats_file"].as<std::string>() : "";
+		std::string csv_file = node["csv_file"] ? node["csv_file"].as<std::string>() : "";
+		std::string binary_file = node["binary_file"] ? node["binary_file"].as<std::string>() : "";
+		if (csv_file == "" && binary_file == "") {
+			return true;
+		}
+		if (!results_.open(csv_file, binary_file)) {
+			return false;
+		}
+		if (csv_file != "") {
+			logger::info() << " |-- results csv: " << utils::colorText(TextType::SUCCESS_B, csv_file);
+		}
+		if (binary_file != "") {
+			logger::info() << " |-- results binary: " << utils::colorText(TextType::SUCCESS_B, binary_file);
+		}
+		return true;
+	}
+	
+	bool loadCacheConfig(YAML::Node node) {
+		if (!node) {
+			return true;
+		}
+		double cache_mb = node["cache_mb"] ? node["cache_mb"].as<double>() : 0.0;
+		cache_params_.spill_file = node["spill_file"] ? node["spill_file"].as<std::string>() : "";
+		if (cache_mb < 0) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for cache_mb");
+			return false;
+		}
+		cache_params_.budget_bytes = size_t(cache_mb * 1024.0 * 1024.0);
+		if (cache_params_.budget_bytes > 0) {
+			// The viewer caches its rendered frames with this budget, decoded images
+			// are only kept for modes that read them again (enableImageCache)
+			logger::info() << " |-- cache: " << utils::colorText(TextType::SUCCESS_B, cv::format("%.0lf MB", cache_mb) + (cache_params_.spill_file != "" ? ", viewer frames spill to " + cache_params_.spill_file : ""));
+		}
+		return true;
+	}
+	
+	bool loadPerfConfig(YAML::Node node) {
+		if (!node) {
+			return true;
+		}
+		perf_tolerance_.median = node["tolerance"] ? node["tolerance"].as<double>() : perf_tolerance_.median;
+		perf_tolerance_.p99 = node["p99_tolerance"] ? node["p99_tolerance"].as<double>() : perf_tolerance_.p99;
+		perf_tolerance_.confidence = node["confidence"] ? node["confidence"].as<double>() : perf_tolerance_.confidence;
+		perf_tolerance_.resamples = node["bootstrap"] ? node["bootstrap"].as<int>() : perf_tolerance_.resamples;
+		perf_tolerance_.warmup = node["warmup"] ? node["warmup"].as<int>() : perf_tolerance_.warmup;
+		if (perf_tolerance_.median < 0 || perf_tolerance_.p99 < 0 || perf_tolerance_.confidence <= 0 || perf_tolerance_.confidence >= 1 || perf_tolerance_.resamples < 1 || perf_tolerance_.warmup < 0) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for tolerance, p99_tolerance, confidence, bootstrap or warmup");
+			return false;
+		}
+		return true;
+	}
+	
+	bool loadSampleConfig(YAML::Node node) {
+		if (!node) {
+			return true;
+		}
+		sample_params_.seed = node["seed"] ? node["seed"].as<uint32_t>() : sample_params_.seed;
+		sample_params_.stratified = node["stratified"] ? node["stratified"].as<bool>() : sample_params_.stratified;
+		sample_params_.ci_width = node["ci_width"] ? node["ci_width"].as<double>() : sample_params_.ci_width;
+		sample_params_.confidence = node["confidence"] ? node["confidence"].as<double>() : sample_params_.confidence;
+		sample_params_.min_images = node["min_images"] ? node["min_images"].as<int>() : sample_params_.min_images;
+		sample_params_.max_images = node["max_images"] ? node["max_images"].as<int>() : sample_params_.max_images;
+		if (sample_params_.ci_width <= 0 || sample_params_.confidence <= 0 || sample_params_.confidence >= 1 || sample_params_.min_images < 2 || sample_params_.max_images < 0) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid config for ci_width, confidence, min_images or max_images");
+			return false;
+		}
+		return true;
+	}
+	
+	// Most frequent label class of image 'index' (smallest id on ties), -1 without labels
+	int dominantClass(int index) {
+		std::vector<annotation_io::Annotation> labels;
+		dataset_.annotations(size_t(index), labels);
+		std::map<int, int> counts;
+		int best = -1, best_count = 0;
+		for (size_t i=0; i<labels.size(); i++) {
+			int count = ++counts[labels[i].id];
+			if (count > best_count || (count == best_count && labels[i].id < best)) {
+				best = labels[i].id;
+				best_count = count;
+			}
+		}
+		return best;
+	}
+	
+	// Once, when the first image is done: per-phase startup times and how long it took to get there
+	void reportStartup() {
+		if (startup_reported_) {
+			return;
+		}
+		startup_reported_ = true;
+		double first_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startup_start_).count();
+		double sequential_ms = startup_ms_.classnames + startup_ms_.dataset + startup_ms_.model + startup_ms_.warmup;
+		logger::info() << " |-- startup: " << utils::colorText(TextType::SUCCESS_B, cv::format("classnames %.1lf ms, dataset %.1lf ms, network %.1lf ms + warm-up %.1lf ms (in parallel with the dataset)",
+			startup_ms_.classnames, startup_ms_.dataset, startup_ms_.model, startup_ms_.warmup));
+		logger::info() << " |-- first image evaluated after: " << utils::colorText(TextType::SUCCESS_B, cv::format("%.1lf ms (phases add up to %.1lf ms)", first_ms, sequential_ms));
+	}
+	
+	// Decodes image 'index' (or takes it from the image cache) and measures how long it took
+	struct LoadedImage {
+		MyImageInfo item;
+		double decode_ms = 0.0;
+	};
+	LoadedImage loadTimed(int index) {
+		LoadedImage loaded;
+		auto t_start = std::chrono::high_resolution_clock::now();
+		RenderedFrame cached;
+		if (images_.get(index, cached)) {
+			loaded.item.name = cached.name;
+			loaded.item.path = image_root_ + "/" + dataset_.key(index);
+			loaded.item.image = cached.image;
+			dataset_.labels(index, cached.image.size(), loaded.item.labels);
+		} else {
+			loaded.item = dataset_.load(index, image_root_);
+			if (!loaded.item.image.empty() && images_.enabled()) {
+				cached.ok = true;
+				cached.name = loaded.item.name;
+				cached.image = loaded.item.image;
+				images_.put(index, cached);
+			}
+		}
+		loaded.decode_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count();
+		return loaded;
+	}
+	
+	void closeResults() {
+		if (results_.isOpen()) {
+			size_t num_records = results_.numRecords();
+			results_.close();
+			logger::info() << " |-- results: " << utils::colorText(TextType::SUCCESS_B, cv::format("%d records written", int(num_records)));
+		}
+	}
+	
+	// Per-class table and confusion matrix of the evaluated images, saved to 'stats_file' if set
+	void reportStats() {
+		if (!classnames_.empty()) {
+			stats_.resize(classnames_.rbegin()->first + 1);
+		}
+		stats_.report(classnames_);
+		if (stats_file_ != "" && stats_.save(stats_file_, classnames_)) {
+			logger::info() << " |-- class statistics: " << utils::colorText(TextType::SUCCESS_B, stats_file_);
+		}
+	}
+	
+	struct ModelParams {
+		int width = 0;
+		int height = 0;
+		std::string weights_file = "";
+		std::string cfg_file = "";
+		double conf = 0.5;
+		double nms = 0.4;
+		nms::Mode nms_mode = nms::CLASS_AGNOSTIC;
+		nms::Method nms_method = nms::HARD;
+		double nms_sigma = 0.5;
+		bool letterbox = false;
+	};
+	
+	struct StartupTimes {
+		double classnames = 0.0;
+		double dataset = 0.0;
+		double model = 0.0;
+		double warmup = 0.0;
+	};
+	
+	struct CacheParams {
+		size_t budget_bytes = 0;		// 0: decoded images are not cached
+		std::string spill_file = "";	// prefix of the viewer's spill files
+	};
+	
+	struct SampleParams {
+		uint32_t seed = 0;
+		bool stratified = true;
+		double ci_width = 0.02;			// full width of the interval
+		double confidence = 0.95;
+		int min_images = 30;
+		int max_images = 0;					// 0: the whole test set
+	};
+	
 	bool is_ok_;
+	bool dataset_only_ = false;
+	bool keep_log_level_ = false;
+	bool use_consolidated_ = false;
+	int viewer_radius_ = 2;
+	int viewer_workers_ = 1;
+	int viewer_cache_size_ = 16;
+	ModelParams model_params_;
+	std::once_flag model_once_;
+	std::shared_future<bool> model_ready_;
+	std::chrono::high_resolution_clock::time_point startup_start_;
+	StartupTimes startup_ms_;
+	bool startup_reported_ = false;
+	ResultWriter results_;
+	CacheParams cache_params_;
+	FrameCache images_;
+	ClassStats stats_;
+	std::string stats_file_ = "";
+	perf::Tolerance perf_tolerance_;
+	SampleParams sample_params_;
 	std::string image_root_;
+	std::unordered_map<std::string, annotation_io::ImageAnnotations> annotations_;
+	std::unordered_map<std::string, std::string> annotation_names_;
 	std::string test_file_prefix_;
-	std::vector<MyImageInfo> test_images_;
+	DatasetStore dataset_;
 	std::map<int, std::string> classnames_;
 	Detector detector_;
 };
 
+// Keeps the test sets and networks of the --serve mode resident between requests
+class EvalService {
+public:
+	EvalService(int num_workers) : num_workers_(std::max(1, num_workers)), detectors_(num_workers_, DetectorCache(MAX_DETECTORS)) {}
+	
+	// Streams one 'image' line per evaluated image, followed by its 'record' lines,
+	// and ends with 'done <images> <accuracy> <elapsed ms>' or 'error <message>'
+	bool handle(int worker, const EvalRequest &request, const EvalServer::Emit &emit) {
+		auto t_start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<MyTools> tools = this->getTools(request.config_file);
+		if (!tools) {
+			return emit("error\tFailed loading config: " + request.config_file);
+		}
+		
+		// A Detector is not thread-safe, so every worker owns its networks
+		std::string key = request.config_file + "|" + request.weights_file + "|" + request.cfg_file;
+		std::shared_ptr<Detector> detector;
+		if (!detectors_[worker].get(key, detector)) {
+			detector.reset(new Detector());
+			tools->initDetector(*detector, request.weights_file, request.cfg_file);
+			// Jobs run side by side, each preprocesses on its share of the cores
+			detector->setThreads(std::max(1, omp_get_max_threads() / num_workers_));
+			detector->warmUp();
+			detectors_[worker].put(key, detector);
+		}
+		tools->setThresholds(*detector, request.conf_thr, request.nms_thr);
+		
+		double accuracy = 0.0;
+		int num_evaluated = 0;
+		bool completed = tools->evaluate(*detector, [&](int index, const std::string &name, double acc, const std::vector<ResultRecord> &records) {
+			// One write per image
+			std::string lines = cv::format("image\t%d\t%s\t%.6lf", index, name.c_str(), acc);
+			for (size_t i=0; request.records && i<records.size(); i++) {
+				const ResultRecord &r = records[i];
+				lines += cv::format("\nrecord\t%d\t%d\t%.6f\t%.6f\t%d", int(r.label_class), int(r.detected_class), r.iou, r.confidence, int(r.matched));
+			}
+			return emit(lines);
+		}, accuracy, num_evaluated);
+		if (!completed) {
+			logger::warn() << " |-- " << utils::colorText(TextType::WARNING_B, "Client left before the end of " + request.config_file);
+			return false;
+		}
+		
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count();
+		logger::info() << " |-- served: " << utils::colorText(TextType::SUCCESS_B, cv::format("%s, %d images, accuracy %.3lf in %.1lf ms (worker %d)", request.config_file.c_str(), num_evaluated, accuracy, elapsed, worker));
+		return emit(cv::format("done\t%d\t%.6lf\t%.3lf", num_evaluated, accuracy, elapsed));
+	}
+	
+private:
+	// Loads each config once; concurrent requests for the same config wait for the first load
+	std::shared_ptr<MyTools> getTools(const std::string &config_file) {
+		std::promise<std::shared_ptr<MyTools> > promise;
+		std::shared_future<std::shared_ptr<MyTools> > future;
+		bool load = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto it = tools_.find(config_file);
+			if (it == tools_.end()) {
+				future = promise.get_future().share();
+				tools_[config_file] = future;
+				load = true;
+			} else {
+				future = it->second;
+			}
+		}
+		if (load) {
+			std::shared_ptr<MyTools> tools;
+			try {
+				tools.reset(new MyTools(config_file, true));
+			} catch (const std::exception &e) {
+				logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, std::string("Failed loading config: ") + e.what());
+			}
+			if (tools && !tools->isOk()) {
+				tools.reset();
+			}
+			if (tools) {
+				// Every request evaluates the whole test set again
+				tools->enableImageCache();
+			}
+			if (!tools) {
+				// Not cached, a fixed config is picked up by the next request
+				std::lock_guard<std::mutex> lock(mutex_);
+				tools_.erase(config_file);
+			}
+			promise.set_value(tools);
+		}
+		return future.get();
+	}
+	
+	std::mutex mutex_;
+	std::map<std::string, std::shared_future<std::shared_ptr<MyTools> > > tools_;
+	int num_workers_;
+	// Per worker, keyed by config, weights and cfg file. Bounded, so clients cycling
+	// through weights do not keep every network they ever used loaded.
+	static const size_t MAX_DETECTORS = 4;
+	typedef LruCache<std::string, std::shared_ptr<Detector> > DetectorCache;
+	std::vector<DetectorCache> detectors_;
+};
+
+static EvalServer *g_server = nullptr;
+
+static void stopServer(int) {
+	if (g_server) {
+		g_server->requestStop();
+	}
+}
+
+// Per-class statistics of a binary results file in one streaming pass, each row group
+// reduced in parallel. 'names_file' (.names, one class per line) and 'stats_file' are optional.
+static bool computeStats(std::string results_file, std::string names_file, std::string stats_file) {
+	std::map<int, std::string> classnames;
+	if (names_file != "") {
+		std::ifstream reader(names_file.c_str());
+		if (!reader.is_open()) {
+			logger::error() << " |-- " << utils::colorText(TextType::DANGER_B, "Invalid path: " + names_file);
+			return false;
+		}
+		std::string line;
+		while (std::getline(reader, line)) {
+			if (line != "") {
+				classnames.insert(std::pair<int, std::string>(int(classnames.size()), line));
+			}
+		}
+	}
+	
+	ResultReader reader;
+	if (!reader.open(results_file)) {
+		return false;
+	}
+	ClassStats stats(int(classnames.size()));
+	std::vector<ResultRecord> rows;
+	size_t num_records = 0;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	while (reader.next(rows)) {
+		stats.addAll(rows.data(), rows.size());
+		num_records += rows.size();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+	logger::info() << " |-- records: " << utils::colorText(TextType::SUCCESS_B, cv::format("%zu in %.2lf s", num_records, elapsed));
+	stats.report(classnames);
+	if (stats_file != "") {
+		if (!stats.save(stats_file, classnames)) {
+			return false;
+		}
+		logger::info() << " |-- class statistics: " << utils::colorText(TextType::SUCCESS_B, stats_file);
+	}
+	return true;
+}
+
 void checkInput(int argc, char **argv, int &i, std::string key, std::string &value) {
 	if (i+1 < argc) {
 		value = argv[i+1];
@@ -518,6 +1498,17 @@ static void showUsage(std::string name) {
 		<< "\nOptions:"
 		<< "\n  -h, --help\tShow this help message"
 		<< "\n  -c, --config\tConfig about the training"
+		<< "\n  --export-annotations\tWrite the test set labels to one file (.json: COCO, otherwise line-delimited)"
+		<< "\n  -b, --batch\tEvaluate every image once without the viewer"
+		<< "\n  --log-level\tdebug, info, warn, error or off (default: info)"
+		<< "\n  --perf-baseline\tRun the batch and record per-stage latencies to a baseline file"
+		<< "\n  --perf-compare\tRun the batch and compare with a baseline file, exit 1 on regression"
+		<< "\n  -s, --sample\tEvaluate a random sample until the accuracy interval is narrow enough"
+		<< "\n  --serve\tServe evaluation requests on a Unix socket, no config needed"
+		<< "\n  --workers\tNumber of concurrent jobs of --serve (default: 2)"
+		<< "\n  --stats\tPer-class statistics and confusion matrix of a binary results file, no config needed"
+		<< "\n  --names\tClass names (.names) for --stats"
+		<< "\n  --stats-file\tSave the statistics of --stats to a YAML file"
 		<< std::endl;
 	std::cout << utils::colorText(TextType::INFO, ss.str()) << std::endl;
 }
@@ -562,15 +1553,189 @@ void testIOUComputation() {
 	}
 }
 
+void testLabelStore() {
+	// Boxes from the DatasetStore must match the original getValue parser bit for bit
+	std::vector<std::string> files = {
+		"0 0.7 0.7 0.3 0.3\n1 0.5 0.5 0.1 0.1\n",
+		"2 0.9083 0.7075 0.0667 0.0781\n0 0.35 0.15 0.29 0.57\n",
+		"5 0.123456 0.654321 0.2 0.6\n3 0.99 0.01 0.03 0.07\n-1 0.5 0.5 0.5 0.5\n4 0.5 0.5 0.0 0.3\n"
+	};
+	std::vector<cv::Size> sizes = { cv::Size(10, 10), cv::Size(200, 200), cv::Size(1920, 1080), cv::Size(416, 416) };
+
+	DatasetStore store;
+	std::vector<std::string> label_files;
+	for (size_t f=0; f<files.size(); f++) {
+		std::string label_file = "/tmp/iou_label_test_" + std::to_string(f) + ".txt";
+		std::ofstream writer(label_file.c_str());
+		writer << files[f];
+		writer.close();
+		label_files.push_back(label_file);
+
+		store.addImage("image_" + std::to_string(f) + ".jpg");
+		std::vector<annotation_io::Annotation> labels = annotation_io::readYoloFile(label_file);
+		for (size_t k=0; k<labels.size(); k++) {
+			store.addLabel(labels[k]);
+		}
+	}
+
+	int mismatches = 0;
+	for (size_t f=0; f<label_files.size(); f++) {
+		for (size_t s=0; s<sizes.size(); s++) {
+			std::vector<MyBox> expected, actual;
+			std::ifstream reader(label_files[f].c_str());
+			std::string line;
+			while (std::getline(reader, line)) {
+				if (line != "") {
+					MyBox item = my_utils::getValue(line, " ", sizes[s]);
+					if (item.id >= 0 && item.box.width > 0 && item.box.height > 0) {
+						expected.push_back(item);
+					}
+				}
+			}
+			store.labels(f, sizes[s], actual);
+			bool same = (expected.size() == actual.size());
+			for (size_t k=0; same && k<expected.size(); k++) {
+				same = expected[k].id == actual[k].id && expected[k].cx == actual[k].cx
+					&& expected[k].cy == actual[k].cy && expected[k].box == actual[k].box;
+			}
+			mismatches += same ? 0 : 1;
+		}
+		std::remove(label_files[f].c_str());
+	}
+	bool same = (mismatches == 0);
+	std::cout << " -- Label files: " << label_files.size() << ", image sizes: " << sizes.size()
+			<< ", mismatches: " << mismatches << std::endl;
+	std::cout << " -- Equivalent: " << utils::colorText(same ? TextType::SUCCESS_B : TextType::DANGER_B, same ? "yes" : "no") << std::endl;
+}
+
+void testNMS() {
+	// Dense random scene, compared against cv::dnn::NMSBoxes in class-agnostic hard mode
+	cv::RNG rng(12345);
+	int N = 20000;
+	std::vector<cv::Rect> boxes;
+	std::vector<float> scores;
+	std::vector<int> class_ids;
+	for (int i=0; i<N; i++) {
+		int w = rng.uniform(10, 120);
+		int h = rng.uniform(10, 120);
+		boxes.push_back(cv::Rect(rng.uniform(0, 1920 - w), rng.uniform(0, 1080 - h), w, h));
+		scores.push_back(float(int(rng.uniform(0.0, 1.0) * 1000)) / 1000.f);
+		class_ids.push_back(rng.uniform(0, 3));
+	}
+	
+	nms::Params params;
+	params.score_thr = 0.3f;
+	params.iou_thr = 0.4f;
+	params.mode = nms::CLASS_AGNOSTIC;
+	
+	std::vector<int> expected, actual;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	cv::dnn::NMSBoxes(boxes, scores, params.score_thr, params.iou_thr, expected);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	nms::run(boxes, scores, class_ids, params, actual);
+	auto t2 = std::chrono::high_resolution_clock::now();
+	
+	bool same = (expected == actual);
+	std::cout << " -- NMS boxes: " << N
+			<< ", OpenCV: " << expected.size() << " kept in " << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms"
+			<< ", nms::run: " << actual.size() << " kept in " << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms"
+			<< std::endl;
+	std::cout << " -- Equivalent: " << utils::colorText(same ? TextType::SUCCESS_B : TextType::DANGER_B, same ? "yes" : "no") << std::endl;
+	
+	// Class-aware mode must match OpenCV run separately on every class
+	params.mode = nms::CLASS_AWARE;
+	nms::run(boxes, scores, class_ids, params, actual);
+	std::vector<int> per_class;
+	for (int c=0; c<3; c++) {
+		std::vector<int> subset;
+		std::vector<cv::Rect> sub_boxes;
+		std::vector<float> sub_scores;
+		for (int i=0; i<N; i++) {
+			if (class_ids[i] == c) {
+				subset.push_back(i);
+				sub_boxes.push_back(boxes[i]);
+				sub_scores.push_back(scores[i]);
+			}
+		}
+		std::vector<int> kept;
+		cv::dnn::NMSBoxes(sub_boxes, sub_scores, params.score_thr, params.iou_thr, kept);
+		for (size_t k=0; k<kept.size(); k++) {
+			per_class.push_back(subset[kept[k]]);
+		}
+	}
+	std::sort(per_class.begin(), per_class.end());
+	std::sort(actual.begin(), actual.end());
+	same = (per_class == actual);
+	std::cout << " -- Class-aware equivalent: " << utils::colorText(same ? TextType::SUCCESS_B : TextType::DANGER_B, same ? "yes" : "no") << std::endl;
+}
+
+void benchmarkPreprocess() {
+	// Fused kernel against cv::dnn::blobFromImage, same scale/size/swapRB as Detector::detect
+	cv::Size net_size(416, 416);
+	double scale = 1.0 / 255.0;
+	cv::Scalar mean(0, 0, 0);
+	std::vector<cv::Size> sizes = { cv::Size(1920, 1080), cv::Size(1280, 720), cv::Size(640, 480), cv::Size(208, 208) };
+	int repeats = 200;
+	cv::RNG rng(12345);
+	
+	for (size_t i=0; i<sizes.size(); i++) {
+		cv::Mat image(sizes[i], CV_8UC3);
+		rng.fill(image, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::GaussianBlur(image, image, cv::Size(5, 5), 0);
+		
+		cv::Mat expected;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (int r=0; r<repeats; r++) {
+			expected = cv::dnn::blobFromImage(image, scale, net_size, mean, true, false);
+		}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		preprocess::Plan plan;
+		cv::Mat actual;
+		for (int r=0; r<repeats; r++) {
+			preprocess::toBlob(image, net_size, false, scale, mean, plan, actual);
+		}
+		auto t2 = std::chrono::high_resolution_clock::now();
+		
+		// blobFromImage rounds its resized 8-bit image, allow one 8-bit step
+		double max_diff = cv::norm(expected, actual, cv::NORM_INF);
+		bool same = max_diff <= scale;
+		std::cout << " -- " << sizes[i].width << "x" << sizes[i].height << " -> " << net_size.width << "x" << net_size.height
+				<< ", blobFromImage: " << std::chrono::duration<double, std::milli>(t1 - t0).count() / repeats << " ms"
+				<< ", preprocess::toBlob: " << std::chrono::duration<double, std::milli>(t2 - t1).count() / repeats << " ms"
+				<< ", max diff: " << max_diff * 255.0 << "/255 "
+				<< utils::colorText(same ? TextType::SUCCESS_B : TextType::DANGER_B, same ? "ok" : "mismatch") << std::endl;
+	}
+}
+
 int main(int argc, char **argv) {
 	
 	//testIOUComputation();
 	//return 0;
 	
+	// testLabelStore();
+	// return 0;
+	
+	// testNMS();
+	// return 0;
+	
+	// benchmarkPreprocess();
+	// return 0;
+	
 	// testStringPattern();
 	// return 0;
 
 	std::string config_file("");
+	std::string export_file("");
+	std::string log_level("");
+	std::string perf_baseline_file("");
+	std::string perf_compare_file("");
+	std::string serve_socket("");
+	std::string num_workers("2");
+	std::string stats_results_file("");
+	std::string names_file("");
+	std::string stats_file("");
+	bool batch = false;
+	bool sample = false;
 	
 	for (int i=1; i<argc; i++) {
 		std::string arg = argv[i];
@@ -578,23 +1743,98 @@ int main(int argc, char **argv) {
 			return 1;
 		} else if (arg == "-c" || arg == "--config") {
 			checkInput(argc, argv, i, "--config", config_file);
+		} else if (arg == "--export-annotations") {
+			checkInput(argc, argv, i, "--export-annotations", export_file);
+		} else if (arg == "-b" || arg == "--batch") {
+			batch = true;
+		} else if (arg == "-s" || arg == "--sample") {
+			sample = true;
+		} else if (arg == "--log-level") {
+			checkInput(argc, argv, i, "--log-level", log_level);
+		} else if (arg == "--perf-baseline") {
+			checkInput(argc, argv, i, "--perf-baseline", perf_baseline_file);
+		} else if (arg == "--perf-compare") {
+			checkInput(argc, argv, i, "--perf-compare", perf_compare_file);
+		} else if (arg == "--serve") {
+			checkInput(argc, argv, i, "--serve", serve_socket);
+		} else if (arg == "--workers") {
+			checkInput(argc, argv, i, "--workers", num_workers);
+		} else if (arg == "--stats") {
+			checkInput(argc, argv, i, "--stats", stats_results_file);
+		} else if (arg == "--names") {
+			checkInput(argc, argv, i, "--names", names_file);
+		} else if (arg == "--stats-file") {
+			checkInput(argc, argv, i, "--stats-file", stats_file);
 		}
 	}
 	
+	logger::start();
+	// Before any config is read, so that loading it logs at this level too
+	if (log_level != "") {
+		logger::Level level;
+		if (!logger::parseLevel(log_level, level)) {
+			logger::error() << utils::colorText(TextType::DANGER_B, "Invalid log level: " + log_level);
+			logger::stop();
+			return -1;
+		}
+		logger::setLevel(level);
+	}
+	
+	if (serve_socket != "") {
+		int workers = std::max(1, std::atoi(num_workers.c_str()));
+		EvalService service(workers);
+		EvalServer server(workers, [&service](int worker, const EvalRequest &request, const EvalServer::Emit &emit) {
+			return service.handle(worker, request, emit);
+		});
+		if (!server.listen(serve_socket)) {
+			logger::stop();
+			return -1;
+		}
+		g_server = &server;
+		std::signal(SIGINT, stopServer);
+		std::signal(SIGTERM, stopServer);
+		server.serve();
+		g_server = nullptr;
+		logger::stop();
+		return 0;
+	}
+	
+	if (stats_results_file != "") {
+		bool ok = computeStats(stats_results_file, names_file, stats_file);
+		logger::stop();
+		return ok ? 0 : -1;
+	}
+	
 	if (config_file == "") {
-		std::cout << utils::colorText(TextType::DANGER_B, "Invalid config file") << std::endl;
+		logger::error() << utils::colorText(TextType::DANGER_B, "Invalid config file");
 		showUsage(argv[0]);
 		return -1;
 	} else {
 		if (!utils::isValidPath(config_file)) {
-			std::cout << utils::colorText(TextType::DANGER_B, "Invalid config file: " + config_file) << std::endl;
+			logger::error() << utils::colorText(TextType::DANGER_B, "Invalid config file: " + config_file);
 			showUsage(argv[0]);
 			return -1;	
 		}
 	}
 	
-	MyTools mytools(config_file);
-	mytools.run();
+	// Exporting labels needs neither the network nor the result files
+	MyTools mytools(config_file, export_file != "", log_level != "");
+	
+	int code = 0;
+	if (export_file != "") {
+		code = mytools.exportAnnotations(export_file) ? 0 : -1;
+	} else if (perf_baseline_file != "") {
+		code = mytools.runPerfBaseline(perf_baseline_file) ? 0 : -1;
+	} else if (perf_compare_file != "") {
+		code = mytools.runPerfCompare(perf_compare_file);
+	} else if (sample) {
+		code = mytools.runSampled() ? 0 : -1;
+	} else if (batch) {
+		code = mytools.runBatch() ? 0 : -1;
+	} else {
+		mytools.run();
+	}
 	
-	return 0;
+	logger::stop();
+	return code;
 }